@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "aggregate.h"
+
+void aggregate_init(AggregateReport *report, OutputBuffer *out, size_t max_depth, size_t top) {
+    memset(report, 0, sizeof(*report));
+    report->out = out;
+    report->max_depth = max_depth;
+    report->top = top;
+    if (top > 0) {
+        report->heap = (TopEntry*)calloc(top, sizeof(TopEntry));
+        if (!report->heap) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    report->links = inode_set_create();
+}
+
+static void totals_add(DirTotals *totals, unsigned long long size, unsigned long long blocks, long long mtime) {
+    totals->apparent += size;
+    totals->allocated += blocks * 512;
+    if (mtime > totals->newest) {
+        totals->newest = mtime;
+    }
+}
+
+int aggregate_linked(const struct statx *stats, AggregateLink *link) {
+    if (stats->stx_nlink <= 1 || S_ISDIR(stats->stx_mode)) {
+        return 0;
+    }
+    link->dev = makedev(stats->stx_dev_major, stats->stx_dev_minor);
+    link->ino = stats->stx_ino;
+    link->size = stats->stx_size;
+    link->blocks = stats->stx_blocks;
+    link->mtime = stats->stx_mtime.tv_sec;
+    return 1;
+}
+
+void aggregate_link(AggregateReport *report, DirTotals *totals, const AggregateLink *link) {
+    if (inode_set_insert(report->links, link->dev, link->ino)) {
+        totals->files++;
+        totals_add(totals, link->size, link->blocks, link->mtime);
+    }
+}
+
+void aggregate_entry(AggregateReport *report, DirTotals *totals, const struct statx *stats) {
+    AggregateLink link;
+    if (aggregate_linked(stats, &link)) {
+        aggregate_link(report, totals, &link);
+        return;
+    }
+    totals->files++;
+    totals_add(totals, stats->stx_size, stats->stx_blocks, stats->stx_mtime.tv_sec);
+}
+
+void aggregate_dir(DirTotals *totals, int dir_fd) {
+    struct stat st;
+    if (fstat(dir_fd, &st) == 0) {
+        totals_add(totals, (unsigned long long)st.st_size, (unsigned long long)st.st_blocks, st.st_mtim.tv_sec);
+    }
+}
+
+void totals_merge(DirTotals *to, const DirTotals *from) {
+    to->files += from->files;
+    to->apparent += from->apparent;
+    to->allocated += from->allocated;
+    if (from->newest > to->newest) {
+        to->newest = from->newest;
+    }
+}
+
+/* "allocated KiB <tab> apparent bytes <tab> files <tab> newest mtime <tab> path" */
+static void print_totals(OutputBuffer *out, const char *path, const DirTotals *totals) {
+    char when[32] = "-";
+    time_t newest = (time_t)totals->newest;
+    struct tm tm;
+    if (totals->newest > 0 && localtime_r(&newest, &tm)) {
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+    }
+    char prefix[128];
+    snprintf(prefix, sizeof(prefix), "%llu\t%llu\t%llu\t%s\t",
+             (totals->allocated + 1023) / 1024, totals->apparent, totals->files, when);
+    output_text(out, prefix);
+    output_text(out, path);
+    output_text(out, "\n");
+}
+
+static void heap_sift_down(TopEntry *heap, size_t size, size_t i) {
+    for (;;) {
+        size_t smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && heap[left].totals.allocated < heap[smallest].totals.allocated)
+            smallest = left;
+        if (right < size && heap[right].totals.allocated < heap[smallest].totals.allocated)
+            smallest = right;
+        if (smallest == i)
+            return;
+        TopEntry tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void heap_push(AggregateReport *report, const char *path, const DirTotals *totals) {
+    TopEntry *heap = report->heap;
+    if (report->heap_size == report->top) {
+        if (totals->allocated <= heap[0].totals.allocated) {
+            return;
+        }
+        free(heap[0].path);
+        heap[0].totals = *totals;
+        heap[0].path = strdup(path);
+        heap_sift_down(heap, report->heap_size, 0);
+        return;
+    }
+    size_t i = report->heap_size++;
+    heap[i].totals = *totals;
+    heap[i].path = strdup(path);
+    while (i > 0 && heap[(i - 1) / 2].totals.allocated > heap[i].totals.allocated) {
+        TopEntry tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+void aggregate_report_dir(AggregateReport *report, const char *path, size_t depth, const DirTotals *totals) {
+    if (depth > report->max_depth) {
+        return;
+    }
+    if (report->top > 0) {
+        heap_push(report, path, totals);
+    } else {
+        print_totals(report->out, path, totals);
+        output_tick(report->out);
+    }
+}
+
+static int compare_top(const void *a, const void *b) {
+    unsigned long long x = ((const TopEntry*)a)->totals.allocated;
+    unsigned long long y = ((const TopEntry*)b)->totals.allocated;
+    return (x < y) - (x > y);
+}
+
+void aggregate_finish(AggregateReport *report) {
+    qsort(report->heap, report->heap_size, sizeof(TopEntry), compare_top);
+    for (size_t i = 0; i < report->heap_size; i++) {
+        print_totals(report->out, report->heap[i].path, &report->heap[i].totals);
+        free(report->heap[i].path);
+    }
+    free(report->heap);
+    report->heap = NULL;
+    report->heap_size = 0;
+    inode_set_destroy(report->links);
+    report->links = NULL;
+}
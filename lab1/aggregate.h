@@ -0,0 +1,62 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "inode_set.h"
+
+/* statx fields -A needs for every entry. */
+#define AGGREGATE_STAT_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_BLOCKS | STATX_MTIME | STATX_NLINK | STATX_INO)
+
+/* Totals of one directory and everything below it. Files are every
+ * counted non-directory entry; a hard-linked inode is counted once. */
+typedef struct DirTotals {
+    unsigned long long files;
+    unsigned long long apparent;
+    unsigned long long allocated;
+    long long newest;
+} DirTotals;
+
+/* A hard-linked file, counted by the first directory it is added to. */
+typedef struct AggregateLink {
+    dev_t dev;
+    ino_t ino;
+    unsigned long long size;
+    unsigned long long blocks;
+    long long mtime;
+} AggregateLink;
+
+typedef struct TopEntry {
+    DirTotals totals;
+    char *path;
+} TopEntry;
+
+/* -A output: directories are reported in post-order (children before their
+ * parent, like du) down to max_depth, or collected into a min-heap of the
+ * top largest by allocated bytes and printed largest first at the end. */
+typedef struct AggregateReport {
+    OutputBuffer *out;
+    size_t max_depth;
+    size_t top;
+    TopEntry *heap;
+    size_t heap_size;
+    InodeSet *links;
+} AggregateReport;
+
+void aggregate_init(AggregateReport *report, OutputBuffer *out, size_t max_depth, size_t top);
+/* Adds one counted entry. Safe to call from several threads on different
+ * totals; the hard-link set is shared. */
+void aggregate_entry(AggregateReport *report, DirTotals *totals, const struct statx *stats);
+/* For a hard-linked non-directory, fills link and returns 1 so the caller
+ * can add it with aggregate_link() once the order is known; else 0. */
+int aggregate_linked(const struct statx *stats, AggregateLink *link);
+/* Adds link to totals unless its inode was added already. */
+void aggregate_link(AggregateReport *report, DirTotals *totals, const AggregateLink *link);
+/* Adds a directory's own inode (from fstat of its fd). */
+void aggregate_dir(DirTotals *totals, int dir_fd);
+void totals_merge(DirTotals *to, const DirTotals *from);
+void aggregate_report_dir(AggregateReport *report, const char *path, size_t depth, const DirTotals *totals);
+void aggregate_finish(AggregateReport *report);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+char *arena_strdup(StringArena *arena, const char *str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+char *arena_strndup(StringArena *arena, const char *str, size_t len) {
+    ArenaChunk *chunk = arena->head;
+    size_t size = len + 1;
+    if (!chunk || chunk->capacity - chunk->used < size) {
+        size_t capacity = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+        chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + capacity);
+        if (!chunk) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = arena->head;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        arena->head = chunk;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    chunk->used += size;
+    arena->bytes += size;
+    return copy;
+}
+
+void arena_adopt(StringArena *to, StringArena *from) {
+    if (!from->head) {
+        return;
+    }
+    ArenaChunk *tail = from->head;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    tail->next = to->head;
+    to->head = from->head;
+    to->bytes += from->bytes;
+    from->head = NULL;
+    from->bytes = 0;
+}
+
+void arena_free(StringArena *arena) {
+    ArenaChunk *chunk = arena->head;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->bytes = 0;
+}
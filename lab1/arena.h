@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} ArenaChunk;
+
+/* Bump allocator for path strings: bytes are packed into large chunks and
+ * released all at once by arena_free(). bytes counts the strings stored,
+ * not the chunks reserved for them. */
+typedef struct StringArena {
+    ArenaChunk *head;
+    size_t bytes;
+} StringArena;
+
+char *arena_strdup(StringArena *arena, const char *str);
+/* Copies the first len bytes of str and terminates them. */
+char *arena_strndup(StringArena *arena, const char *str, size_t len);
+/* Moves every chunk of from into to, leaving from empty. */
+void arena_adopt(StringArena *to, StringArena *from);
+void arena_free(StringArena *arena);
+
+#endif
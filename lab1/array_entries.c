@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array_entries.h"
+
+void add_entry_ref(ArrayEntries *array, uint32_t dir, const char *stored_name, int flag) {
+    if (array->size == array->capacity) {
+        array->capacity = array->capacity ? array->capacity * 2 : 1024;
+        array->entries = (Map*)realloc(array->entries, array->capacity * sizeof(Map));
+        if (!array->entries) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    array->entries[array->size].flag = flag;
+    array->entries[array->size].dir = dir;
+    array->entries[array->size].name = stored_name;
+    array->size++;
+}
+
+void add_entry_at(ArrayEntries *array, uint32_t dir, const char *name, int flag) {
+    add_entry_ref(array, dir, arena_strdup(&array->strings, name), flag);
+}
+
+void add_entry(ArrayEntries *array, const char* full_path, int flag) {
+    const char *slash = strrchr(full_path, '/');
+    if (!slash) {
+        add_entry_at(array, PATH_NO_DIR, full_path, flag);
+        return;
+    }
+    size_t len = (size_t)(slash - full_path);
+    PathBuffer *last = &array->last_dir_path;
+    if (!last->data || last->len != len || memcmp(last->data, full_path, len) != 0) {
+        array->last_dir = path_table_dir(&array->paths, full_path, len);
+        last->len = 0;
+        path_reserve(last, len);
+        memcpy(last->data, full_path, len);
+        path_truncate(last, len);
+    }
+    add_entry_at(array, array->last_dir, slash + 1, flag);
+}
+
+const char *entry_path(const ArrayEntries *array, size_t i, PathBuffer *out) {
+    path_table_path(&array->paths, array->entries[i].dir, array->entries[i].name, out);
+    return out->data;
+}
+
+void clear_entries(ArrayEntries *array) {
+    arena_free(&array->strings);
+    array->size = 0;
+}
+
+void free_entries(ArrayEntries *array) {
+    free(array->entries);
+    arena_free(&array->strings);
+    path_table_free(&array->paths);
+    path_free(&array->last_dir_path);
+    array->entries = NULL;
+    array->size = 0;
+    array->capacity = 0;
+}
@@ -1,6 +1,43 @@
+#ifndef ARRAY_ENTRIES_H
+#define ARRAY_ENTRIES_H
+
 #include "map.h"
+#include <stddef.h>
+#include "arena.h"
+#include "path_table.h"
 
+/* Entries collected for -s. Directories live in paths and survive
+ * clear_entries(), since entries still to come may sit below them; the
+ * names in strings are dropped with the entries. */
 typedef struct ArrayEntries {
-    int size;
+    size_t size;
+    size_t capacity;
     Map *entries;
-} ArrayEntries;
\ No newline at end of file
+    StringArena strings;
+    PathTable paths;
+    uint32_t last_dir;
+    PathBuffer last_dir_path;
+} ArrayEntries;
+
+/* Splits full_path at its last '/' and stores it under the interned
+ * directory; consecutive entries of one directory reuse the lookup. */
+void add_entry(ArrayEntries *array, const char* full_path, int flag);
+/* Copies name into the array's string arena. */
+void add_entry_at(ArrayEntries *array, uint32_t dir, const char *name, int flag);
+/* stored_name must already live in an arena owned by the array. */
+void add_entry_ref(ArrayEntries *array, uint32_t dir, const char *stored_name, int flag);
+/* Materializes the path of entries[i] into out and returns out->data. */
+const char *entry_path(const ArrayEntries *array, size_t i, PathBuffer *out);
+/* Drops every entry but keeps the index allocation and the directories
+ * for reuse. */
+void clear_entries(ArrayEntries *array);
+void free_entries(ArrayEntries *array);
+
+/* Bytes held by the current entries. The index and arena chunks kept or
+ * reserved for later entries are left out, so a small -M budget still
+ * collects many entries per run. */
+static inline size_t entries_bytes(const ArrayEntries *array) {
+    return array->size * sizeof(Map) + array->strings.bytes;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Cold-cache comparison of the synchronous statx path (-S) with the io_uring
+# backend (-S -u). Dropping the page cache needs root; without it the runs
+# are warm and the script says so.
+# Usage: ./bench_cold.sh [directory] [runs] [extra dirwalk flags]
+
+DIR=${1:-/usr}
+RUNS=${2:-3}
+EXTRA=${3:-}
+DIRWALK=${DIRWALK:-./dirwalk}
+
+drop_caches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+        echo cold
+    else
+        echo warm
+    fi
+}
+
+now() {
+    date +%s.%N
+}
+
+echo "mode,run,cache,seconds"
+for run in $(seq 1 "$RUNS"); do
+    for mode in sync uring; do
+        flags="-S $EXTRA"
+        [ "$mode" = uring ] && flags="$flags -u"
+        cache=$(drop_caches)
+        start=$(now)
+        $DIRWALK $flags "$DIR" > /dev/null 2>&1
+        end=$(now)
+        echo "$mode,$run,$cache,$(awk "BEGIN { printf \"%.3f\", $end - $start }")"
+    done
+done
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+/* Runs dirwalk over a single directory chain thousands of levels deep.
+ * Full paths quickly pass PATH_MAX, so the chain is built and removed with
+ * *at() calls, climbing back up through "..". */
+
+#define MAX_RUN_ARGS 16
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_level(int fd, int files) {
+    for (int i = 0; i < files; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", i);
+        close(openat(fd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+    }
+}
+
+static void build_chain(const char *root, int depth, int files) {
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int level = 0; fd != -1 && level < depth; level++) {
+        fill_level(fd, files);
+        if (mkdirat(fd, "d", 0755) == -1) {
+            perror("mkdirat");
+            exit(EXIT_FAILURE);
+        }
+        int child = openat(fd, "d", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = child;
+    }
+    if (fd == -1) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    fill_level(fd, files);
+    close(fd);
+}
+
+static void remove_chain(const char *root, int depth, int files) {
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int level = 0; fd != -1 && level < depth; level++) {
+        int child = openat(fd, "d", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = child;
+    }
+    for (int level = depth; fd != -1; level--) {
+        for (int i = 0; i < files; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "f%d", i);
+            unlinkat(fd, name, 0);
+        }
+        if (level == 0)
+            break;
+        int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = parent;
+        if (fd != -1)
+            unlinkat(fd, "d", AT_REMOVEDIR);
+    }
+    if (fd != -1)
+        close(fd);
+    rmdir(root);
+}
+
+/* Runs dirwalk with flags on root, counting the lines it prints. */
+static void run_dirwalk(const char *dirwalk, const char *flags, const char *root) {
+    char flag_copy[256];
+    snprintf(flag_copy, sizeof(flag_copy), "%s", flags);
+    char *args[MAX_RUN_ARGS + 3];
+    int argc = 0;
+    args[argc++] = (char*)dirwalk;
+    char *saveptr = NULL;
+    for (char *flag = strtok_r(flag_copy, " ", &saveptr); flag && argc < MAX_RUN_ARGS; flag = strtok_r(NULL, " ", &saveptr)) {
+        args[argc++] = flag;
+    }
+    args[argc++] = (char*)root;
+    args[argc] = NULL;
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        exit(EXIT_FAILURE);
+    }
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        execv(dirwalk, args);
+        perror("execv");
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    unsigned long lines = 0;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            lines += (buffer[i] == '\n');
+        }
+    }
+    close(pipe_fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double elapsed = now_sec() - start;
+    char result[32];
+    if (WIFSIGNALED(status)) {
+        snprintf(result, sizeof(result), "signal %d", WTERMSIG(status));
+    } else {
+        snprintf(result, sizeof(result), "exit %d", WEXITSTATUS(status));
+    }
+    printf("%-12s %10lu %10.3f %12ld %10s\n", flags[0] ? flags : "(none)", lines, elapsed, usage.ru_maxrss, result);
+}
+
+int main(int argc, char *argv[]) {
+    int depth = (argc > 1) ? atoi(argv[1]) : 10000;
+    int files = (argc > 2) ? atoi(argv[2]) : 4;
+    const char *base = (argc > 3) ? argv[3] : "/tmp";
+    const char *dirwalk = getenv("DIRWALK") ? getenv("DIRWALK") : "./dirwalk";
+    if (depth < 1 || files < 0) {
+        fprintf(stderr, "Usage: %s [depth] [files per level] [base dir] [dirwalk flags...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s/bench_deep.XXXXXX", base);
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    build_chain(root, depth, files);
+    printf("chain: %d levels, %d files per level, %lu entries\n", depth, files,
+           (unsigned long)depth * (files + 1) + files);
+
+    static const char *default_runs[] = {"", "-g", "-d", "-s", "-S"};
+    printf("%-12s %10s %10s %12s %10s\n", "flags", "lines", "seconds", "max RSS KiB", "status");
+    if (argc > 4) {
+        for (int i = 4; i < argc; i++) {
+            run_dirwalk(dirwalk, argv[i], root);
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(default_runs) / sizeof(default_runs[0]); i++) {
+            run_dirwalk(dirwalk, default_runs[i], root);
+        }
+    }
+    remove_chain(root, depth, files);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#!/bin/sh
+# Cold-cache comparison of statx in readdir order (-S) with statx in inode
+# order (-S -i), synchronous and through io_uring. By default it builds an
+# ext4 image on a loop device opened with direct I/O, fills it with
+# directories whose readdir (hash) order is unrelated to their inode order,
+# and remounts it before every run, so each run starts with no cached
+# inodes and the loop device does not read through the page cache. Given
+# a directory instead, it drops the page cache between runs like
+# bench_cold.sh. Both need root; without it the runs are warm and the
+# script says so.
+# Usage: ./bench_inode.sh [directory] [runs] [dirs] [files per dir]
+
+DIR=${1:-}
+RUNS=${2:-3}
+DIRS=${3:-64}
+FILES=${4:-2000}
+DIRWALK=${DIRWALK:-./dirwalk}
+
+IMAGE=
+MOUNT=
+LOOP=
+
+cleanup() {
+    if [ -n "$MOUNT" ]; then
+        umount "$MOUNT" 2>/dev/null
+        rmdir "$MOUNT"
+    fi
+    [ -n "$LOOP" ] && losetup -d "$LOOP" 2>/dev/null
+    [ -n "$IMAGE" ] && rm -f "$IMAGE"
+}
+trap cleanup EXIT
+
+make_image() {
+    IMAGE=$(mktemp "${TMPDIR:-/tmp}/bench_inode.XXXXXX") || return 1
+    MOUNT=$(mktemp -d "${TMPDIR:-/tmp}/bench_inode_mnt.XXXXXX") || return 1
+    truncate -s 1G "$IMAGE" && mkfs.ext4 -q -F -N $((DIRS * FILES + DIRS + 1024)) "$IMAGE" || return 1
+    LOOP=$(losetup --direct-io=on -f --show "$IMAGE" 2>/dev/null || losetup -f --show "$IMAGE") || return 1
+    mount "$LOOP" "$MOUNT" || return 1
+    # Files are created in name order, so inodes are allocated in name
+    # order while readdir returns them in hash order.
+    for d in $(seq 1 "$DIRS"); do
+        mkdir "$MOUNT/d$d"
+        (cd "$MOUNT/d$d" && seq -f "f%06g" 1 "$FILES" | xargs touch)
+    done
+    sync
+    DIR=$MOUNT
+}
+
+drop_caches() {
+    sync
+    if [ -n "$LOOP" ]; then
+        umount "$MOUNT" && mount "$LOOP" "$MOUNT" && echo cold && return
+    elif [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+        echo cold
+        return
+    fi
+    echo warm
+}
+
+now() {
+    date +%s.%N
+}
+
+# Read requests completed by the loop device, 0 without one.
+device_reads() {
+    if [ -n "$LOOP" ]; then
+        awk '{ print $1 }' "/sys/block/${LOOP#/dev/}/stat"
+    else
+        echo 0
+    fi
+}
+
+if [ -z "$DIR" ]; then
+    if [ "$(id -u)" -ne 0 ] || ! make_image; then
+        echo "cannot build a loop-mounted image (needs root, mkfs.ext4 and losetup); pass a directory" >&2
+        exit 1
+    fi
+fi
+
+echo "mode,run,cache,seconds,device_reads"
+for run in $(seq 1 "$RUNS"); do
+    for mode in readdir inode readdir-uring inode-uring; do
+        case $mode in
+            readdir) flags="-S" ;;
+            inode) flags="-S -i" ;;
+            readdir-uring) flags="-S -u" ;;
+            inode-uring) flags="-S -i -u" ;;
+        esac
+        cache=$(drop_caches)
+        reads=$(device_reads)
+        start=$(now)
+        $DIRWALK $flags "$DIR" > /dev/null 2>&1
+        end=$(now)
+        reads=$(($(device_reads) - reads))
+        echo "$mode,$run,$cache,$(awk "BEGIN { printf \"%.3f\", $end - $start }"),$reads"
+    done
+done
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+/* Compares lstat(full_path) with fstatat(dir_fd, name) on a deep directory
+ * chain: the first resolves every component again, the second only the last. */
+
+#define FILES_PER_LEVEL 16
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void remove_chain(char *path, size_t root_len, int depth) {
+    for (int level = depth; level >= 0; level--) {
+        size_t len = root_len + (size_t)level * 2;
+        path[len] = '\0';
+        for (int i = 0; i < FILES_PER_LEVEL; i++) {
+            char file[PATH_MAX + 16];
+            snprintf(file, sizeof(file), "%s/f%d", path, i);
+            unlink(file);
+        }
+        rmdir(path);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int depth = (argc > 1) ? atoi(argv[1]) : 512;
+    int rounds = (argc > 2) ? atoi(argv[2]) : 20;
+    const char *base = (argc > 3) ? argv[3] : "/tmp";
+    if (depth < 1 || rounds < 1 || depth * 2 + 64 > PATH_MAX) {
+        fprintf(stderr, "Usage: %s [depth < %d] [rounds] [base dir]\n", argv[0], (PATH_MAX - 64) / 2);
+        exit(EXIT_FAILURE);
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/bench_lookup.XXXXXX", base);
+    if (!mkdtemp(path)) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    size_t root_len = strlen(path);
+    int *fds = (int*)malloc(sizeof(int) * (depth + 1));
+    if (!fds) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int level = 0; level <= depth; level++) {
+        if (level > 0) {
+            strcat(path, "/d");
+            if (mkdir(path, 0755) == -1) {
+                perror("mkdir");
+                exit(EXIT_FAILURE);
+            }
+        }
+        fds[level] = open(path, O_RDONLY | O_DIRECTORY);
+        for (int i = 0; i < FILES_PER_LEVEL; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "f%d", i);
+            close(openat(fds[level], name, O_WRONLY | O_CREAT, 0644));
+        }
+    }
+
+    printf("%8s %14s %14s %8s\n", "depth", "lstat ns/op", "fstatat ns/op", "ratio");
+    for (int level = 1; ; level *= 2) {
+        if (level > depth)
+            level = depth;
+        char dir[PATH_MAX];
+        memcpy(dir, path, root_len + (size_t)level * 2);
+        dir[root_len + (size_t)level * 2] = '\0';
+        struct stat st;
+
+        double start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < FILES_PER_LEVEL; i++) {
+                char file[PATH_MAX + 16];
+                snprintf(file, sizeof(file), "%s/f%d", dir, i);
+                lstat(file, &st);
+            }
+        }
+        double by_path = (now_ns() - start) / (rounds * FILES_PER_LEVEL);
+
+        start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < FILES_PER_LEVEL; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "f%d", i);
+                fstatat(fds[level], name, &st, AT_SYMLINK_NOFOLLOW);
+            }
+        }
+        double by_fd = (now_ns() - start) / (rounds * FILES_PER_LEVEL);
+        printf("%8d %14.0f %14.0f %7.1fx\n", level, by_path, by_fd, by_path / by_fd);
+        if (level == depth)
+            break;
+    }
+
+    for (int level = 0; level <= depth; level++) {
+        close(fds[level]);
+    }
+    free(fds);
+    remove_chain(path, root_len, depth);
+    return 0;
+}
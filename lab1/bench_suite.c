@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+
+/* Builds reproducible synthetic trees on tmpfs and on disk, runs dirwalk
+ * over each in several modes and prints one CSV row per run: entries/sec,
+ * syscalls per entry (counted by the bench_syscount.so interposer), peak
+ * RSS and time to first output. Trees are built right before the runs, so
+ * the page cache is warm; bench_cold.sh covers the cold case. */
+
+#define TMPFS_MAGIC 0x01021994
+#define MAX_RUN_ARGS 16
+
+typedef struct TreeShape {
+    const char *name;
+    void (*build)(int root_fd, int scale, uint64_t *seed);
+} TreeShape;
+
+static const char *modes[] = {"", "-g", "-S", "-S -u", "-j 4", "-S -j 4", "-s", "-L"};
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_dir(int parent_fd, const char *name) {
+    if (mkdirat(parent_fd, name, 0755) == -1) {
+        perror("mkdirat");
+        exit(EXIT_FAILURE);
+    }
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("openat");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void make_file(int dir_fd, const char *name, size_t size) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("openat");
+        exit(EXIT_FAILURE);
+    }
+    static const char data[64] = "synthetic file contents for the dirwalk benchmark suite......";
+    if (size > 0 && write(fd, data, size > sizeof(data) ? sizeof(data) : size) == -1) {
+        perror("write");
+    }
+    close(fd);
+}
+
+/* One level of 2000 * scale directories with 10 files each. */
+static void build_wide(int root_fd, int scale, uint64_t *seed) {
+    (void)seed;
+    for (int d = 0; d < 2000 * scale; d++) {
+        char name[32];
+        snprintf(name, sizeof(name), "d%05d", d);
+        int fd = make_dir(root_fd, name);
+        for (int f = 0; f < 10; f++) {
+            snprintf(name, sizeof(name), "f%02d", f);
+            make_file(fd, name, 0);
+        }
+        close(fd);
+    }
+}
+
+static void build_deep_level(int fd, int depth, int files) {
+    char name[32];
+    for (int f = 0; f < files; f++) {
+        snprintf(name, sizeof(name), "f%d", f);
+        make_file(fd, name, 0);
+    }
+    if (depth == 0)
+        return;
+    for (int d = 0; d < 4; d++) {
+        snprintf(name, sizeof(name), "d%d", d);
+        int child = make_dir(fd, name);
+        build_deep_level(child, depth - 1, files);
+        close(child);
+    }
+}
+
+/* Complete 4-ary tree of depth 6 (5461 directories), 3 * scale files each. */
+static void build_deep(int root_fd, int scale, uint64_t *seed) {
+    (void)seed;
+    build_deep_level(root_fd, 6, 3 * scale);
+}
+
+/* 200 directories of 500 * scale files holding 1..64 bytes. */
+static void build_tiny(int root_fd, int scale, uint64_t *seed) {
+    for (int d = 0; d < 200; d++) {
+        char name[32];
+        snprintf(name, sizeof(name), "d%03d", d);
+        int fd = make_dir(root_fd, name);
+        for (int f = 0; f < 500 * scale; f++) {
+            snprintf(name, sizeof(name), "t%05d", f);
+            make_file(fd, name, 1 + next_random(seed) % 64);
+        }
+        close(fd);
+    }
+}
+
+/* A single directory of 100000 * scale files with random 8..24 char names. */
+static void build_huge(int root_fd, int scale, uint64_t *seed) {
+    int fd = make_dir(root_fd, "huge");
+    for (int f = 0; f < 100000 * scale; f++) {
+        char name[32];
+        int len = 8 + (int)(next_random(seed) % 17);
+        int n = snprintf(name, sizeof(name), "%08x", f);
+        while (n < len) {
+            name[n++] = (char)('a' + next_random(seed) % 26);
+        }
+        name[n] = '\0';
+        make_file(fd, name, 0);
+    }
+    close(fd);
+}
+
+/* 100 directories of 100 * scale files plus as many symlinks: most point
+ * at sibling files, some at other directories, some nowhere, and every
+ * directory has a "loop" link back to the root. */
+static void build_symlink(int root_fd, int scale, uint64_t *seed) {
+    for (int d = 0; d < 100; d++) {
+        char name[32], target[64];
+        snprintf(name, sizeof(name), "d%03d", d);
+        int fd = make_dir(root_fd, name);
+        for (int f = 0; f < 100 * scale; f++) {
+            snprintf(name, sizeof(name), "f%04d", f);
+            make_file(fd, name, 0);
+            uint64_t kind = next_random(seed) % 10;
+            if (kind < 8) {
+                snprintf(target, sizeof(target), "f%04d", (int)(next_random(seed) % (100 * scale)));
+            } else if (kind == 8) {
+                snprintf(target, sizeof(target), "../d%03d", (int)(next_random(seed) % 100));
+            } else {
+                snprintf(target, sizeof(target), "missing%04d", f);
+            }
+            snprintf(name, sizeof(name), "l%04d", f);
+            if (symlinkat(target, fd, name) == -1) {
+                perror("symlinkat");
+            }
+        }
+        if (symlinkat("..", fd, "loop") == -1) {
+            perror("symlinkat");
+        }
+        close(fd);
+    }
+}
+
+static const TreeShape shapes[] = {
+    {"wide", build_wide},
+    {"deep", build_deep},
+    {"tiny", build_tiny},
+    {"huge", build_huge},
+    {"symlink", build_symlink},
+};
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    if (type == FTW_DP) {
+        rmdir(path);
+    } else {
+        unlink(path);
+    }
+    return 0;
+}
+
+static unsigned long read_syscalls(const char *count_path, unsigned long *statx_calls, unsigned long *getdents_calls) {
+    FILE *file = fopen(count_path, "r");
+    unsigned long total = 0;
+    *statx_calls = *getdents_calls = 0;
+    if (!file) {
+        return 0;
+    }
+    char name[64];
+    unsigned long count;
+    while (fscanf(file, "%63s %lu", name, &count) == 2) {
+        if (strcmp(name, "readdir") == 0)
+            continue;
+        total += count;
+        if (strcmp(name, "statx") == 0)
+            *statx_calls = count;
+        if (strcmp(name, "getdents64") == 0)
+            *getdents_calls = count;
+    }
+    fclose(file);
+    unlink(count_path);
+    return total;
+}
+
+static void run_mode(const char *dirwalk, const char *interposer, const char *fs, const char *tree,
+                     const char *root, const char *mode, int run) {
+    char mode_copy[256];
+    snprintf(mode_copy, sizeof(mode_copy), "%s", mode);
+    char *args[MAX_RUN_ARGS + 3];
+    int argc = 0;
+    args[argc++] = (char*)dirwalk;
+    char *saveptr = NULL;
+    for (char *flag = strtok_r(mode_copy, " ", &saveptr); flag && argc < MAX_RUN_ARGS; flag = strtok_r(NULL, " ", &saveptr)) {
+        args[argc++] = flag;
+    }
+    args[argc++] = (char*)root;
+    args[argc] = NULL;
+
+    char count_path[PATH_MAX];
+    snprintf(count_path, sizeof(count_path), "/tmp/bench_suite.counts.%d", (int)getpid());
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        exit(EXIT_FAILURE);
+    }
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDERR_FILENO);
+        if (interposer) {
+            setenv("LD_PRELOAD", interposer, 1);
+            setenv("DWALK_SYSCOUNT_OUT", count_path, 1);
+        }
+        execv(dirwalk, args);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    unsigned long entries = 0;
+    double first_output = -1;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+        if (first_output < 0)
+            first_output = now_sec() - start;
+        for (ssize_t i = 0; i < n; i++) {
+            entries += (buffer[i] == '\n');
+        }
+    }
+    close(pipe_fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double elapsed = now_sec() - start;
+    unsigned long statx_calls, getdents_calls;
+    unsigned long syscalls = interposer ? read_syscalls(count_path, &statx_calls, &getdents_calls) : 0;
+    if (!interposer)
+        statx_calls = getdents_calls = 0;
+    printf("%s,%s,\"%s\",%d,%d,%lu,%.4f,%.0f,%lu,%.3f,%lu,%lu,%ld,%.2f\n",
+           fs, tree, mode, run, WIFEXITED(status) ? WEXITSTATUS(status) : -1, entries, elapsed,
+           elapsed > 0 ? entries / elapsed : 0.0, syscalls, entries ? (double)syscalls / entries : 0.0,
+           statx_calls, getdents_calls, usage.ru_maxrss, first_output < 0 ? -1.0 : first_output * 1000);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    int scale = 1, runs = 1, keep = 0;
+    const char *tmpfs_base = "/dev/shm";
+    const char *disk_base = "/tmp";
+    const char *dirwalk = getenv("DIRWALK") ? getenv("DIRWALK") : "./dirwalk";
+    const char *interposer = getenv("BENCH_SYSCOUNT") ? getenv("BENCH_SYSCOUNT") : "./bench_syscount.so";
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:t:d:k")) != -1) {
+        switch (opt) {
+            case 's':
+                scale = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 't':
+                tmpfs_base = optarg;
+                break;
+            case 'd':
+                disk_base = optarg;
+                break;
+            case 'k':
+                keep = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s scale] [-r runs] [-t tmpfs dir] [-d disk dir] [-k]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (scale < 1 || runs < 1) {
+        fprintf(stderr, "Scale and runs must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (access(interposer, R_OK) != 0) {
+        fprintf(stderr, "%s not found, syscall columns will be 0\n", interposer);
+        interposer = NULL;
+    } else {
+        char *resolved = realpath(interposer, NULL);
+        interposer = resolved ? resolved : interposer;
+    }
+
+    const char *bases[2] = {tmpfs_base, disk_base};
+    const char *fs_names[2] = {"tmpfs", "disk"};
+    printf("fs,tree,mode,run,exit,entries,seconds,entries_per_sec,syscalls,syscalls_per_entry,"
+           "statx,getdents64,max_rss_kib,first_output_ms\n");
+    for (int b = 0; b < 2; b++) {
+        struct statfs fs;
+        if (statfs(bases[b], &fs) == -1) {
+            perror(bases[b]);
+            continue;
+        }
+        if ((b == 0) != (fs.f_type == TMPFS_MAGIC)) {
+            fprintf(stderr, "note: %s is %sa tmpfs\n", bases[b], fs.f_type == TMPFS_MAGIC ? "" : "not ");
+        }
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+            char root[PATH_MAX];
+            snprintf(root, sizeof(root), "%s/bench_suite.%s.XXXXXX", bases[b], shapes[s].name);
+            if (!mkdtemp(root)) {
+                perror("mkdtemp");
+                exit(EXIT_FAILURE);
+            }
+            int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            uint64_t seed = 0x9e3779b97f4a7c15ULL + s;
+            shapes[s].build(root_fd, scale, &seed);
+            close(root_fd);
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+                for (int run = 1; run <= runs; run++) {
+                    run_mode(dirwalk, interposer, fs_names[b], shapes[s].name, root, modes[m], run);
+                }
+            }
+            if (keep) {
+                fprintf(stderr, "kept %s\n", root);
+            } else {
+                nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+            }
+        }
+    }
+    return 0;
+}
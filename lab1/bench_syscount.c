@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* LD_PRELOAD interposer for bench_suite: counts the libc entry points
+ * dirwalk reaches the kernel through and writes "name count" lines to
+ * $DWALK_SYSCOUNT_OUT at exit. Calls glibc makes internally (the
+ * getdents64 behind readdir, the fstat in fdopendir) do not go through the
+ * PLT and are not seen; readdir is listed separately for that reason and
+ * not counted as a syscall. */
+
+enum {
+    COUNT_OPENAT,
+    COUNT_CLOSE,
+    COUNT_STATX,
+    COUNT_FSTATAT,
+    COUNT_FSTAT,
+    COUNT_GETDENTS,
+    COUNT_URING,
+    COUNT_WRITE,
+    COUNT_FDOPENDIR,
+    COUNT_OTHER,
+    COUNT_READDIR,
+    COUNT_MAX
+};
+
+static const char *count_names[COUNT_MAX] = {
+    "openat", "close", "statx", "fstatat", "fstat", "getdents64", "io_uring_enter",
+    "write", "fdopendir", "other", "readdir"
+};
+
+static unsigned long counts[COUNT_MAX];
+
+#define COUNT(which) __atomic_fetch_add(&counts[which], 1, __ATOMIC_RELAXED)
+#define REAL(name) \
+    static __typeof__(name) *real_##name; \
+    if (!real_##name) \
+        real_##name = (__typeof__(name)*)dlsym(RTLD_NEXT, #name)
+
+int openat(int dir_fd, const char *path, int flags, ...) {
+    REAL(openat);
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    COUNT(COUNT_OPENAT);
+    return real_openat(dir_fd, path, flags, mode);
+}
+
+int open(const char *path, int flags, ...) {
+    REAL(open);
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    COUNT(COUNT_OPENAT);
+    return real_open(path, flags, mode);
+}
+
+int close(int fd) {
+    REAL(close);
+    COUNT(COUNT_CLOSE);
+    return real_close(fd);
+}
+
+int statx(int dir_fd, const char *path, int flags, unsigned int mask, struct statx *buf) {
+    REAL(statx);
+    COUNT(COUNT_STATX);
+    return real_statx(dir_fd, path, flags, mask, buf);
+}
+
+int fstatat(int dir_fd, const char *path, struct stat *buf, int flags) {
+    REAL(fstatat);
+    COUNT(COUNT_FSTATAT);
+    return real_fstatat(dir_fd, path, buf, flags);
+}
+
+int lstat(const char *path, struct stat *buf) {
+    REAL(lstat);
+    COUNT(COUNT_FSTATAT);
+    return real_lstat(path, buf);
+}
+
+int stat(const char *path, struct stat *buf) {
+    REAL(stat);
+    COUNT(COUNT_FSTATAT);
+    return real_stat(path, buf);
+}
+
+int fstat(int fd, struct stat *buf) {
+    REAL(fstat);
+    COUNT(COUNT_FSTAT);
+    return real_fstat(fd, buf);
+}
+
+ssize_t write(int fd, const void *data, size_t size) {
+    REAL(write);
+    COUNT(COUNT_WRITE);
+    return real_write(fd, data, size);
+}
+
+DIR *fdopendir(int fd) {
+    REAL(fdopendir);
+    COUNT(COUNT_FDOPENDIR);
+    return real_fdopendir(fd);
+}
+
+struct dirent *readdir(DIR *dir) {
+    REAL(readdir);
+    COUNT(COUNT_READDIR);
+    return real_readdir(dir);
+}
+
+long syscall(long number, ...) {
+    REAL(syscall);
+    va_list args;
+    va_start(args, number);
+    long a = va_arg(args, long), b = va_arg(args, long), c = va_arg(args, long);
+    long d = va_arg(args, long), e = va_arg(args, long), f = va_arg(args, long);
+    va_end(args);
+    if (number == SYS_getdents64) {
+        COUNT(COUNT_GETDENTS);
+    } else if (number == SYS_io_uring_enter) {
+        COUNT(COUNT_URING);
+    } else {
+        COUNT(COUNT_OTHER);
+    }
+    return real_syscall(number, a, b, c, d, e, f);
+}
+
+__attribute__((destructor)) static void write_counts(void) {
+    const char *path = getenv("DWALK_SYSCOUNT_OUT");
+    if (!path) {
+        return;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return;
+    }
+    for (int i = 0; i < COUNT_MAX; i++) {
+        fprintf(file, "%s %lu\n", count_names[i], __atomic_load_n(&counts[i], __ATOMIC_RELAXED));
+    }
+    fclose(file);
+}
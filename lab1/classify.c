@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "classify.h"
+#include "walk_options.h"
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static void batch_resize(EntryBatch *batch, size_t capacity) {
+    batch->capacity = capacity;
+    batch->name_offsets = (size_t*)xrealloc(batch->name_offsets, capacity * sizeof(size_t));
+    batch->types = (unsigned char*)xrealloc(batch->types, capacity);
+    batch->inos = (uint64_t*)xrealloc(batch->inos, capacity * sizeof(uint64_t));
+    batch->order = (size_t*)xrealloc(batch->order, capacity * sizeof(size_t));
+    batch->flags = (int*)xrealloc(batch->flags, capacity * sizeof(int));
+    batch->pending_names = (const char**)xrealloc(batch->pending_names, capacity * sizeof(const char*));
+    batch->pending_stats = (struct statx**)xrealloc(batch->pending_stats, capacity * sizeof(struct statx*));
+    batch->pending_index = (size_t*)xrealloc(batch->pending_index, capacity * sizeof(size_t));
+    batch->pending_results = (int*)xrealloc(batch->pending_results, capacity * sizeof(int));
+    if (batch->stats) {
+        batch->stats = (struct statx*)xrealloc(batch->stats, capacity * sizeof(struct statx));
+    }
+}
+
+static void batch_reserve(EntryBatch *batch) {
+    if (!batch->capacity) {
+        batch_resize(batch, BATCH_MAX_ENTRIES);
+    }
+}
+
+/* Makes room for one more entry when the batch may hold a whole directory. */
+static int batch_grow(EntryBatch *batch) {
+    if (!batch->inode_order) {
+        return 0;
+    }
+    batch_resize(batch, batch->capacity * 2);
+    return 1;
+}
+
+size_t batch_fill(EntryBatch *batch, DirReader *reader) {
+    batch_reserve(batch);
+    batch->size = 0;
+    batch->use_order = 0;
+    batch->names_size = 0;
+    DirRecord record;
+    while ((batch->size < batch->capacity || batch_grow(batch)) && dir_reader_next(reader, &record) == 1) {
+        if (strcmp(record.name, ".") == 0 || strcmp(record.name, "..") == 0)
+            continue;
+        size_t len = strlen(record.name) + 1;
+        if (batch->names_size + len > batch->names_capacity) {
+            batch->names_capacity = batch->names_capacity ? batch->names_capacity * 2 : 16384;
+            while (batch->names_size + len > batch->names_capacity) {
+                batch->names_capacity *= 2;
+            }
+            batch->names = (char*)xrealloc(batch->names, batch->names_capacity);
+        }
+        memcpy(batch->names + batch->names_size, record.name, len);
+        batch->name_offsets[batch->size] = batch->names_size;
+        batch->types[batch->size] = record.type;
+        batch->inos[batch->size] = record.ino;
+        batch->names_size += len;
+        batch->size++;
+    }
+    return batch->size;
+}
+
+static int type_flag(unsigned char type) {
+    switch (type) {
+        case DT_LNK:
+            return 0;
+        case DT_REG:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+static int stat_one(int dir_fd, const char *name, unsigned int mask, struct statx *file_stat, WalkCounters *counters) {
+    counters->stat_calls++;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, mask, file_stat) == -1) {
+        perror("statx");
+        return -1;
+    }
+    return classify_entry(file_stat->stx_mode);
+}
+
+/* Inode numbers roughly follow inode table placement, so statting in
+ * d_ino order turns scattered inode-table reads into a forward sweep. */
+static int compare_inos(const void *a, const void *b, void *inos) {
+    uint64_t x = ((const uint64_t*)inos)[*(const size_t*)a];
+    uint64_t y = ((const uint64_t*)inos)[*(const size_t*)b];
+    return (x > y) - (x < y);
+}
+
+static void alloc_stats(EntryBatch *batch) {
+    if (!batch->stats) {
+        batch->stats = (struct statx*)xrealloc(NULL, batch->capacity * sizeof(struct statx));
+    }
+}
+
+/* Entry at position pos of a range: readdir order, or inode order once a
+ * shared batch has been sorted by batch_share(). */
+static inline size_t entry_at(const EntryBatch *batch, size_t pos) {
+    return batch->use_order ? batch->order[pos] : pos;
+}
+
+void batch_classify_range(EntryBatch *batch, size_t begin, size_t end, int dir_fd, unsigned int mask, StatRing **ring,
+                          WalkCounters *counters) {
+    size_t pending = begin;
+    counters->entries += end - begin;
+    for (size_t pos = begin; pos < end; pos++) {
+        size_t i = entry_at(batch, pos);
+        if (!mask && batch->types[i] != DT_UNKNOWN) {
+            batch->flags[i] = type_flag(batch->types[i]);
+            counters->stats_avoided++;
+            continue;
+        }
+        alloc_stats(batch);
+        batch->pending_names[pending] = batch_name(batch, i);
+        batch->pending_stats[pending] = &batch->stats[i];
+        batch->pending_index[pending] = i;
+        pending++;
+    }
+    size_t count = pending - begin;
+    if (count == 0) {
+        return;
+    }
+    if (batch->inode_order && !batch->use_order && count > 1) {
+        qsort_r(batch->pending_index + begin, count, sizeof(size_t), compare_inos, batch->inos);
+        for (size_t k = begin; k < pending; k++) {
+            batch->pending_names[k] = batch_name(batch, batch->pending_index[k]);
+            batch->pending_stats[k] = &batch->stats[batch->pending_index[k]];
+        }
+    }
+
+    unsigned int stat_mask = mask | STATX_TYPE;
+    if (*ring && stat_ring_statx(*ring, dir_fd, batch->pending_names + begin, count, stat_mask,
+                                 batch->pending_stats + begin, batch->pending_results + begin) == -1) {
+        perror("io_uring_enter");
+        stat_ring_destroy(*ring);
+        *ring = NULL;
+    } else if (*ring) {
+        for (size_t k = begin; k < pending; k++) {
+            size_t i = batch->pending_index[k];
+            int result = batch->pending_results[k];
+            if (result == -EINVAL) {
+                batch->flags[i] = stat_one(dir_fd, batch->pending_names[k], stat_mask, &batch->stats[i], counters);
+                continue;
+            }
+            counters->ring_stat_calls++;
+            if (result < 0) {
+                errno = -result;
+                perror("statx");
+                batch->flags[i] = -1;
+            } else {
+                batch->flags[i] = classify_entry(batch->stats[i].stx_mode);
+            }
+        }
+        return;
+    }
+    for (size_t k = begin; k < pending; k++) {
+        size_t i = batch->pending_index[k];
+        batch->flags[i] = stat_one(dir_fd, batch->pending_names[k], stat_mask, &batch->stats[i], counters);
+    }
+}
+
+void batch_classify(EntryBatch *batch, int dir_fd, unsigned int mask, StatRing **ring, WalkCounters *counters) {
+    batch_classify_range(batch, 0, batch->size, dir_fd, mask, ring, counters);
+}
+
+void batch_follow_links_range(EntryBatch *batch, size_t begin, size_t end, int dir_fd, unsigned int mask,
+                              WalkCounters *counters) {
+    for (size_t pos = begin; pos < end; pos++) {
+        size_t i = entry_at(batch, pos);
+        if (batch->flags[i] != 0)
+            continue;
+        alloc_stats(batch);
+        counters->stat_calls++;
+        struct statx target;
+        if (statx(dir_fd, batch_name(batch, i), 0, mask | STATX_TYPE, &target) == 0) {
+            batch->stats[i] = target;
+            batch->flags[i] = classify_entry(target.stx_mode);
+        }
+    }
+}
+
+void batch_follow_links(EntryBatch *batch, int dir_fd, unsigned int mask, WalkCounters *counters) {
+    batch_follow_links_range(batch, 0, batch->size, dir_fd, mask, counters);
+}
+
+int batch_needs_stats(const EntryBatch *batch, unsigned int mask) {
+    if (mask) {
+        return 1;
+    }
+    for (size_t i = 0; i < batch->size; i++) {
+        if (batch->types[i] == DT_UNKNOWN)
+            return 1;
+    }
+    return 0;
+}
+
+void batch_share(EntryBatch *batch) {
+    alloc_stats(batch);
+    if (batch->inode_order) {
+        for (size_t i = 0; i < batch->size; i++) {
+            batch->order[i] = i;
+        }
+        qsort_r(batch->order, batch->size, sizeof(size_t), compare_inos, batch->inos);
+        batch->use_order = 1;
+    }
+}
+
+void batch_free(EntryBatch *batch) {
+    free(batch->name_offsets);
+    free(batch->types);
+    free(batch->inos);
+    free(batch->order);
+    free(batch->flags);
+    free(batch->stats);
+    free(batch->names);
+    free(batch->pending_names);
+    free(batch->pending_stats);
+    free(batch->pending_index);
+    free(batch->pending_results);
+    memset(batch, 0, sizeof(*batch));
+}
+
+void add_counters(WalkCounters *total, const WalkCounters *part) {
+    total->entries += part->entries;
+    total->stats_avoided += part->stats_avoided;
+    total->stat_calls += part->stat_calls;
+    total->ring_stat_calls += part->ring_stat_calls;
+    total->revisits += part->revisits;
+    total->other_fs += part->other_fs;
+    total->device_pools += part->device_pools;
+}
@@ -0,0 +1,87 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stddef.h>
+#include "dir_reader.h"
+#include "uring_stat.h"
+
+#define BATCH_MAX_ENTRIES 1024
+#define STAT_RING_ENTRIES 256
+
+typedef struct WalkCounters {
+    unsigned long entries;
+    unsigned long stats_avoided;
+    unsigned long stat_calls;
+    unsigned long ring_stat_calls;
+    unsigned long revisits;
+    unsigned long other_fs;
+    unsigned long device_pools;
+} WalkCounters;
+
+/* Up to BATCH_MAX_ENTRIES records of one directory. Names are copied out of
+ * the reader so they survive buffer refills and recursion into children.
+ * With inode_order (-i) a batch grows to hold the whole directory and its
+ * stats are issued in d_ino order. */
+typedef struct EntryBatch {
+    size_t size;
+    size_t capacity;
+    int inode_order;
+    int use_order;
+    size_t *name_offsets;
+    unsigned char *types;
+    uint64_t *inos;
+    size_t *order;
+    int *flags;
+    struct statx *stats;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    const char **pending_names;
+    struct statx **pending_stats;
+    size_t *pending_index;
+    int *pending_results;
+} EntryBatch;
+
+/* Reads the next batch from reader, skipping "." and "..", or with
+ * inode_order everything left in the directory. Returns the number of
+ * entries, 0 at the end of the directory. */
+size_t batch_fill(EntryBatch *batch, DirReader *reader);
+
+/* Sets flags[i] (0 symlink, 1 file, 2 anything else, -1 on error) for the
+ * whole batch. With mask == 0 the type comes from d_type and only
+ * DT_UNKNOWN entries are stat'ed; otherwise every entry gets statx(mask)
+ * and stats[i] is valid. Stats go through *ring as one submission when it
+ * is set; if the ring fails it is destroyed and *ring reset to NULL. */
+void batch_classify(EntryBatch *batch, int dir_fd, unsigned int mask, StatRing **ring, WalkCounters *counters);
+
+/* -L: re-classifies symlinks by their target with a following statx, so a
+ * link to a directory becomes flag 2 and is descended into. Dangling links
+ * keep flag 0. With mask != 0 stats[i] is replaced by the target's. */
+void batch_follow_links(EntryBatch *batch, int dir_fd, unsigned int mask, WalkCounters *counters);
+
+/* Whether classifying the batch takes any stat calls: always with a mask,
+ * otherwise only for entries without a d_type. */
+int batch_needs_stats(const EntryBatch *batch, unsigned int mask);
+/* Prepares a batch to be classified by several threads at once, one
+ * batch_classify_range() (and batch_follow_links_range() for -L) per
+ * disjoint range: allocates stats up front, and with inode_order sorts the
+ * whole batch so the ranges are slices of one inode-order sweep. */
+void batch_share(EntryBatch *batch);
+/* batch_classify() and batch_follow_links() for positions [begin, end). A
+ * range only touches its own entries and its own slots of the pending
+ * arrays. */
+void batch_classify_range(EntryBatch *batch, size_t begin, size_t end, int dir_fd, unsigned int mask, StatRing **ring,
+                          WalkCounters *counters);
+void batch_follow_links_range(EntryBatch *batch, size_t begin, size_t end, int dir_fd, unsigned int mask,
+                              WalkCounters *counters);
+
+static inline const char *batch_name(const EntryBatch *batch, size_t i) {
+    return batch->names + batch->name_offsets[i];
+}
+
+void batch_free(EntryBatch *batch);
+
+
+void add_counters(WalkCounters *total, const WalkCounters *part);
+
+#endif
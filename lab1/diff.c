@@ -0,0 +1,499 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "diff.h"
+#include "dir_reader.h"
+#include "path_buffer.h"
+
+#define DIFF_SAME 0
+#define DIFF_ADDED 1
+#define DIFF_REMOVED 2
+#define DIFF_TYPE 3
+#define DIFF_SIZE 4
+
+static const char *const change_labels[] = {NULL, "Added: ", "Removed: ", "Type changed: ", "Size changed: "};
+
+/* Both sides of a directory pair, kept open until every subdirectory pair
+ * queued from it has been opened. */
+typedef struct DiffDirs {
+    int fd[2];
+    atomic_int refs;
+} DiffDirs;
+
+/* A pair still to compare: name (path + name_offset) below both of
+ * parent's fds, or the two roots when parent is NULL. path is relative to
+ * the roots, "" for the roots themselves. */
+typedef struct DiffTask {
+    DiffDirs *parent;
+    char *path;
+    size_t name_offset;
+} DiffTask;
+
+typedef struct TreeDiff TreeDiff;
+
+/* One side of the pair being compared: its whole listing and its entries'
+ * positions sorted by name. */
+typedef struct DiffSide {
+    DirReader reader;
+    EntryBatch batch;
+    size_t *order;
+    size_t order_capacity;
+    dev_t dev;
+} DiffSide;
+
+typedef struct DiffWorker {
+    pthread_t thread;
+    TreeDiff *diff;
+    DirBufferPool buffers;
+    DiffSide sides[2];
+    PathBuffer path;
+    char *lines;
+    size_t lines_size;
+    size_t lines_capacity;
+    DiffTask **children;
+    size_t child_count;
+    size_t child_capacity;
+    WalkCounters counters;
+    DiffCounters diff_counters;
+} DiffWorker;
+
+/* tasks is a stack: a worker pushes a pair's subdirectories in reverse,
+ * so with one thread the pairs are compared in depth-first name order.
+ * pending counts tasks queued or being compared; the diff is over when it
+ * drops to zero. */
+struct TreeDiff {
+    const WalkOptions *options;
+    const char *roots[2];
+    OutputBuffer *out;
+    pthread_mutex_t out_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    DiffTask **tasks;
+    size_t task_count;
+    size_t task_capacity;
+    size_t pending;
+};
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static void release_dirs(DiffDirs *dirs) {
+    if (dirs && atomic_fetch_sub(&dirs->refs, 1) == 1) {
+        close(dirs->fd[0]);
+        close(dirs->fd[1]);
+        free(dirs);
+    }
+}
+
+/* Duplicates both readers' fds, which are closed with the readers. */
+static DiffDirs *share_dirs(DiffSide sides[2]) {
+    int fd0 = fcntl(dir_reader_fd(&sides[0].reader), F_DUPFD_CLOEXEC, 0);
+    int fd1 = (fd0 == -1) ? -1 : fcntl(dir_reader_fd(&sides[1].reader), F_DUPFD_CLOEXEC, 0);
+    if (fd1 == -1) {
+        perror("fcntl");
+        if (fd0 != -1) {
+            close(fd0);
+        }
+        return NULL;
+    }
+    DiffDirs *dirs = (DiffDirs*)xrealloc(NULL, sizeof(DiffDirs));
+    dirs->fd[0] = fd0;
+    dirs->fd[1] = fd1;
+    atomic_init(&dirs->refs, 1);
+    return dirs;
+}
+
+static DiffTask *new_task(const char *path, size_t name_offset, DiffDirs *parent) {
+    DiffTask *task = (DiffTask*)xrealloc(NULL, sizeof(DiffTask));
+    task->path = strdup(path);
+    if (!task->path) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+    task->name_offset = name_offset;
+    task->parent = parent;
+    if (parent) {
+        atomic_fetch_add(&parent->refs, 1);
+    }
+    return task;
+}
+
+static void free_task(DiffTask *task) {
+    release_dirs(task->parent);
+    free(task->path);
+    free(task);
+}
+
+static int compare_names(const void *a, const void *b, void *batch) {
+    return strcmp(batch_name((const EntryBatch*)batch, *(const size_t*)a),
+                  batch_name((const EntryBatch*)batch, *(const size_t*)b));
+}
+
+/* Reads the side's whole directory and sorts its positions by name. */
+static void read_side(DiffSide *side) {
+    EntryBatch *batch = &side->batch;
+    batch_fill(batch, &side->reader);
+    if (batch->size > side->order_capacity) {
+        side->order_capacity = batch->capacity;
+        side->order = (size_t*)xrealloc(side->order, side->order_capacity * sizeof(size_t));
+    }
+    for (size_t i = 0; i < batch->size; i++) {
+        side->order[i] = i;
+    }
+    qsort_r(side->order, batch->size, sizeof(size_t), compare_names, batch);
+}
+
+static int type_flag(unsigned char type) {
+    return (type == DT_LNK) ? 0 : (type == DT_REG) ? 1 : 2;
+}
+
+static void add_line(DiffWorker *self, int change, int flag, const char *name) {
+    const WalkOptions *options = self->diff->options;
+    if (flag == -1 || !should_emit(options, flag))
+        return;
+    PathBuffer *path = &self->path;
+    size_t base = path->len;
+    if (base > 0) {
+        path_push(path, name);
+    } else {
+        path_set(path, name);
+    }
+    const char *label = change_labels[change];
+    size_t label_len = strlen(label);
+    size_t needed = self->lines_size + label_len + path->len + 1;
+    if (needed > self->lines_capacity) {
+        self->lines_capacity = self->lines_capacity ? self->lines_capacity : 4096;
+        while (needed > self->lines_capacity) {
+            self->lines_capacity *= 2;
+        }
+        self->lines = (char*)xrealloc(self->lines, self->lines_capacity);
+    }
+    memcpy(self->lines + self->lines_size, label, label_len);
+    memcpy(self->lines + self->lines_size + label_len, path->data, path->len);
+    self->lines_size += label_len + path->len;
+    self->lines[self->lines_size++] = (self->diff->out->format == OUTPUT_NUL) ? '\0' : '\n';
+    path_truncate(path, base);
+    self->diff_counters.differences++;
+}
+
+/* Fills *type from the entry's d_type, or from a statx when it has none or
+ * its size is needed. Returns -1 when the entry could not be stat'ed. */
+static int entry_type(DiffWorker *self, DiffSide *side, size_t i, int fd, int need_size, unsigned char *type,
+                      struct statx *st) {
+    *type = side->batch.types[i];
+    if (*type != DT_UNKNOWN && !need_size) {
+        return 0;
+    }
+    self->counters.stat_calls++;
+    if (statx(fd, batch_name(&side->batch, i), AT_SYMLINK_NOFOLLOW, DIFF_STAT_MASK, st) == -1) {
+        perror("statx");
+        self->diff_counters.errors++;
+        return -1;
+    }
+    *type = IFTODT(st->stx_mode);
+    return 0;
+}
+
+/* Compares the entry both sides have. Returns the change to report, or
+ * DIFF_SAME with *descend set when both are directories to compare. */
+static int compare_entry(DiffWorker *self, size_t index[2], int *descend, int *flag) {
+    DiffSide *sides = self->sides;
+    *descend = 0;
+    *flag = type_flag(sides[1].batch.types[index[1]]);
+    uint64_t ino = sides[0].batch.inos[index[0]];
+    if (ino != 0 && sides[0].dev == sides[1].dev && ino == sides[1].batch.inos[index[1]]) {
+        if (sides[0].batch.types[index[0]] == DT_DIR) {
+            self->diff_counters.same_dirs++;
+        } else {
+            self->diff_counters.linked_entries++;
+        }
+        return DIFF_SAME;
+    }
+    unsigned char types[2];
+    struct statx st[2];
+    int stated[2] = {0, 0};
+    for (int s = 0; s < 2; s++) {
+        int fd = dir_reader_fd(&sides[s].reader);
+        if (entry_type(self, &sides[s], index[s], fd, 0, &types[s], &st[s]) == -1)
+            return DIFF_SAME;
+        stated[s] = sides[s].batch.types[index[s]] == DT_UNKNOWN;
+    }
+    *flag = type_flag(types[1]);
+    if (types[0] != types[1]) {
+        if (!should_emit(self->diff->options, *flag)) {
+            *flag = type_flag(types[0]);
+        }
+        return DIFF_TYPE;
+    }
+    if (types[0] == DT_DIR) {
+        *descend = 1;
+        return DIFF_SAME;
+    }
+    if (types[0] != DT_REG && types[0] != DT_LNK) {
+        return DIFF_SAME;
+    }
+    for (int s = 0; s < 2; s++) {
+        int fd = dir_reader_fd(&sides[s].reader);
+        if (!stated[s] && entry_type(self, &sides[s], index[s], fd, 1, &types[s], &st[s]) == -1)
+            return DIFF_SAME;
+    }
+    return (st[0].stx_size != st[1].stx_size) ? DIFF_SIZE : DIFF_SAME;
+}
+
+/* Flag of an entry only one side has, for the -l/-d/-f filters; costs a
+ * statx only when it has no d_type and a filter is set. */
+static int side_flag(DiffWorker *self, int s, size_t i) {
+    const WalkOptions *options = self->diff->options;
+    DiffSide *side = &self->sides[s];
+    unsigned char type = side->batch.types[i];
+    struct statx st;
+    if (type == DT_UNKNOWN && (options->flag_links || options->flag_dirs || options->flag_files) &&
+        entry_type(self, side, i, dir_reader_fd(&side->reader), 0, &type, &st) == -1) {
+        return -1;
+    }
+    return type_flag(type);
+}
+
+static void add_child(DiffWorker *self, DiffTask *task) {
+    if (self->child_count == self->child_capacity) {
+        self->child_capacity = self->child_capacity ? self->child_capacity * 2 : 64;
+        self->children = (DiffTask**)xrealloc(self->children, self->child_capacity * sizeof(DiffTask*));
+    }
+    self->children[self->child_count++] = task;
+}
+
+/* Opens one side of the task's pair; the roots may be symlinks. */
+static int open_side(const TreeDiff *diff, const DiffTask *task, int side) {
+    if (task->parent) {
+        return open_dir_at(task->parent->fd[side], task->path + task->name_offset, 0);
+    }
+    return open_dir_at(AT_FDCWD, diff->roots[side], 1);
+}
+
+/* Merges the two sorted listings, collects the pair's lines and queues
+ * its common subdirectories in self->children. */
+static void compare_pair(DiffWorker *self, DiffTask *task) {
+    TreeDiff *diff = self->diff;
+    const WalkOptions *options = diff->options;
+    int fd[2];
+    struct stat st[2];
+    for (int s = 0; s < 2; s++) {
+        fd[s] = open_side(diff, task, s);
+        if (fd[s] == -1 || fstat(fd[s], &st[s]) == -1) {
+            self->diff_counters.errors++;
+            if (fd[s] != -1) {
+                perror("fstat");
+                close(fd[s]);
+            }
+            if (s == 1) {
+                close(fd[0]);
+            }
+            return;
+        }
+    }
+    if (st[0].st_dev == st[1].st_dev && st[0].st_ino == st[1].st_ino) {
+        self->diff_counters.same_dirs++;
+        close(fd[0]);
+        close(fd[1]);
+        return;
+    }
+    self->diff_counters.dirs++;
+    for (int s = 0; s < 2; s++) {
+        DiffSide *side = &self->sides[s];
+        char *buffer = (options->reader == READER_GETDENTS) ? dir_buffer_get(&self->buffers, s) : NULL;
+        if (dir_reader_open(&side->reader, fd[s], options->reader, buffer, options->buffer_size) == -1) {
+            self->diff_counters.errors++;
+            if (s == 1) {
+                dir_reader_close(&self->sides[0].reader);
+            } else {
+                close(fd[1]);
+            }
+            return;
+        }
+        side->dev = st[s].st_dev;
+    }
+    read_side(&self->sides[0]);
+    read_side(&self->sides[1]);
+    self->diff_counters.errors += self->sides[0].reader.failed + self->sides[1].reader.failed;
+    size_t entries = self->sides[0].batch.size + self->sides[1].batch.size;
+    unsigned long stat_calls = self->counters.stat_calls;
+    self->counters.entries += entries;
+
+    path_set(&self->path, task->path);
+    DiffDirs *dirs = NULL;
+    int dirs_failed = 0;
+    const EntryBatch *a = &self->sides[0].batch, *b = &self->sides[1].batch;
+    size_t i = 0, j = 0;
+    while (i < a->size || j < b->size) {
+        size_t index[2] = {i < a->size ? self->sides[0].order[i] : 0, j < b->size ? self->sides[1].order[j] : 0};
+        int cmp = (i == a->size) ? 1 : (j == b->size) ? -1 : strcmp(batch_name(a, index[0]), batch_name(b, index[1]));
+        if (cmp < 0) {
+            add_line(self, DIFF_REMOVED, side_flag(self, 0, index[0]), batch_name(a, index[0]));
+            i++;
+            continue;
+        }
+        if (cmp > 0) {
+            add_line(self, DIFF_ADDED, side_flag(self, 1, index[1]), batch_name(b, index[1]));
+            j++;
+            continue;
+        }
+        int descend, flag;
+        int change = compare_entry(self, index, &descend, &flag);
+        const char *name = batch_name(b, index[1]);
+        if (change != DIFF_SAME) {
+            add_line(self, change, flag, name);
+        } else if (descend) {
+            if (!dirs && !dirs_failed) {
+                dirs = share_dirs(self->sides);
+                dirs_failed = !dirs;
+            }
+            if (dirs) {
+                size_t base = self->path.len;
+                if (base > 0) {
+                    path_push(&self->path, name);
+                } else {
+                    path_set(&self->path, name);
+                }
+                add_child(self, new_task(self->path.data, base ? base + 1 : 0, dirs));
+                path_truncate(&self->path, base);
+            }
+        }
+        i++;
+        j++;
+    }
+    self->counters.stats_avoided += entries - (self->counters.stat_calls - stat_calls);
+    dir_reader_close(&self->sides[0].reader);
+    dir_reader_close(&self->sides[1].reader);
+    release_dirs(dirs);
+}
+
+/* Hands the pair's lines to the shared output in one piece and queues its
+ * subdirectories, the first one on top. */
+static void finish_pair(DiffWorker *self) {
+    TreeDiff *diff = self->diff;
+    if (self->lines_size > 0) {
+        pthread_mutex_lock(&diff->out_lock);
+        output_bytes(diff->out, self->lines, self->lines_size);
+        output_tick(diff->out);
+        pthread_mutex_unlock(&diff->out_lock);
+        self->lines_size = 0;
+    }
+    pthread_mutex_lock(&diff->lock);
+    if (diff->task_count + self->child_count > diff->task_capacity) {
+        diff->task_capacity = diff->task_capacity ? diff->task_capacity : 64;
+        while (diff->task_count + self->child_count > diff->task_capacity) {
+            diff->task_capacity *= 2;
+        }
+        diff->tasks = (DiffTask**)xrealloc(diff->tasks, diff->task_capacity * sizeof(DiffTask*));
+    }
+    for (size_t k = self->child_count; k-- > 0;) {
+        diff->tasks[diff->task_count++] = self->children[k];
+    }
+    diff->pending += self->child_count;
+    diff->pending--;
+    if (self->child_count > 1 || diff->pending == 0) {
+        pthread_cond_broadcast(&diff->wake);
+    } else if (self->child_count == 1) {
+        pthread_cond_signal(&diff->wake);
+    }
+    pthread_mutex_unlock(&diff->lock);
+    self->child_count = 0;
+}
+
+static void *worker_main(void *arg) {
+    DiffWorker *self = (DiffWorker*)arg;
+    TreeDiff *diff = self->diff;
+    for (;;) {
+        pthread_mutex_lock(&diff->lock);
+        while (diff->task_count == 0 && diff->pending > 0) {
+            pthread_cond_wait(&diff->wake, &diff->lock);
+        }
+        if (diff->task_count == 0) {
+            pthread_mutex_unlock(&diff->lock);
+            break;
+        }
+        DiffTask *task = diff->tasks[--diff->task_count];
+        pthread_mutex_unlock(&diff->lock);
+        compare_pair(self, task);
+        free_task(task);
+        finish_pair(self);
+    }
+    return NULL;
+}
+
+void tree_diff(const char *root_a, const char *root_b, const WalkOptions *options, OutputBuffer *out,
+               WalkCounters *counters, DiffCounters *diff_counters) {
+    TreeDiff diff;
+    memset(&diff, 0, sizeof(diff));
+    diff.options = options;
+    diff.roots[0] = root_a;
+    diff.roots[1] = root_b;
+    diff.out = out;
+    pthread_mutex_init(&diff.out_lock, NULL);
+    pthread_mutex_init(&diff.lock, NULL);
+    pthread_cond_init(&diff.wake, NULL);
+    diff.tasks = (DiffTask**)xrealloc(NULL, sizeof(DiffTask*));
+    diff.task_capacity = 1;
+    diff.tasks[diff.task_count++] = new_task("", 0, NULL);
+    diff.pending = 1;
+
+    int threads = options->threads;
+    DiffWorker *workers = (DiffWorker*)calloc((size_t)threads, sizeof(DiffWorker));
+    if (!workers) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < threads; i++) {
+        workers[i].diff = &diff;
+        workers[i].buffers.size = options->buffer_size;
+        /* inode_order makes batch_fill() read a whole directory. */
+        workers[i].sides[0].batch.inode_order = 1;
+        workers[i].sides[1].batch.inode_order = 1;
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        DiffWorker *worker = &workers[i];
+        add_counters(counters, &worker->counters);
+        diff_counters->dirs += worker->diff_counters.dirs;
+        diff_counters->same_dirs += worker->diff_counters.same_dirs;
+        diff_counters->linked_entries += worker->diff_counters.linked_entries;
+        diff_counters->differences += worker->diff_counters.differences;
+        diff_counters->errors += worker->diff_counters.errors;
+        for (int s = 0; s < 2; s++) {
+            batch_free(&worker->sides[s].batch);
+            free(worker->sides[s].order);
+        }
+        dir_buffer_free(&worker->buffers);
+        path_free(&worker->path);
+        free(worker->lines);
+        free(worker->children);
+    }
+    free(workers);
+    free(diff.tasks);
+    pthread_mutex_destroy(&diff.out_lock);
+    pthread_mutex_destroy(&diff.lock);
+    pthread_cond_destroy(&diff.wake);
+}
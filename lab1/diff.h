@@ -0,0 +1,39 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "classify.h"
+#include "output.h"
+#include "walk_options.h"
+
+/* statx fields --diff needs for an entry whose type or size is compared. */
+#define DIFF_STAT_MASK (STATX_TYPE | STATX_SIZE)
+
+typedef struct DiffCounters {
+    unsigned long dirs;
+    unsigned long same_dirs;
+    unsigned long linked_entries;
+    unsigned long differences;
+    unsigned long errors;
+} DiffCounters;
+
+/* --diff A B: walks both trees in lockstep, one pair of directories at a
+ * time, and streams to out every entry only in A ("Removed: "), only in B
+ * ("Added: "), of another type on each side ("Type changed: ") or a file
+ * or symlink whose size differs ("Size changed: "), as paths relative to
+ * the two roots. An added or removed directory is one line; its contents
+ * are not listed. Each pair's names are read completely and merged in
+ * strcmp() order. Pairs of subdirectories are shared among
+ * options->threads workers, so the lines of one directory stay together
+ * but with -j directories come out in completion order.
+ * Cheap checks skip work before anything is stat'ed: a pair that is the
+ * same directory (one root inside the other, bind mounts) is not read at
+ * all, an entry that is the same inode on both sides (hard-linked
+ * snapshots) is unchanged, d_type settles types, and only files and
+ * symlinks present on both sides are stat'ed for their sizes.
+ * options->flag_* select the entry types reported. A directory that cannot
+ * be opened or read, or an entry that cannot be stat'ed, is reported on
+ * stderr and counted in diff->errors instead of passing as unchanged. */
+void tree_diff(const char *root_a, const char *root_b, const WalkOptions *options, OutputBuffer *out,
+               WalkCounters *counters, DiffCounters *diff);
+
+#endif
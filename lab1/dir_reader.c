@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "dir_reader.h"
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int dir_reader_open(DirReader *reader, int fd, int backend, char *buffer, size_t buffer_size) {
+    reader->backend = backend;
+    reader->fd = fd;
+    reader->dir = NULL;
+    reader->buffer = buffer;
+    reader->buffer_size = buffer_size;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->failed = 0;
+    if (backend == READER_READDIR) {
+        reader->dir = fdopendir(fd);
+        if (!reader->dir) {
+            perror("fdopendir");
+            close(fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int dir_reader_next(DirReader *reader, DirRecord *record) {
+    if (reader->backend == READER_READDIR) {
+        errno = 0;
+        struct dirent *entry = readdir(reader->dir);
+        if (!entry && errno != 0) {
+            perror("readdir");
+            reader->failed = 1;
+            return -1;
+        }
+        if (!entry) {
+            return 0;
+        }
+        record->name = entry->d_name;
+        record->type = entry->d_type;
+        record->ino = entry->d_ino;
+        return 1;
+    }
+
+    if (reader->pos >= reader->len) {
+        long n = syscall(SYS_getdents64, reader->fd, reader->buffer, reader->buffer_size);
+        if (n == -1) {
+            perror("getdents64");
+            reader->failed = 1;
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        reader->pos = 0;
+        reader->len = (size_t)n;
+    }
+    struct linux_dirent64 *entry = (struct linux_dirent64*)(reader->buffer + reader->pos);
+    reader->pos += entry->d_reclen;
+    record->name = entry->d_name;
+    record->type = entry->d_type;
+    record->ino = entry->d_ino;
+    return 1;
+}
+
+int dir_reader_fd(const DirReader *reader) {
+    return reader->dir ? dirfd(reader->dir) : reader->fd;
+}
+
+void dir_reader_close(DirReader *reader) {
+    if (reader->dir) {
+        closedir(reader->dir);
+    } else {
+        close(reader->fd);
+    }
+    reader->dir = NULL;
+    reader->fd = -1;
+}
+
+char *dir_buffer_get(DirBufferPool *pool, size_t index) {
+    if (index >= pool->count) {
+        size_t count = pool->count ? pool->count : 8;
+        while (count <= index) {
+            count *= 2;
+        }
+        pool->buffers = (char**)realloc(pool->buffers, count * sizeof(char*));
+        if (!pool->buffers) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(pool->buffers + pool->count, 0, (count - pool->count) * sizeof(char*));
+        pool->count = count;
+    }
+    if (!pool->buffers[index]) {
+        pool->buffers[index] = (char*)malloc(pool->size);
+        if (!pool->buffers[index]) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool->buffers[index];
+}
+
+void dir_buffer_free(DirBufferPool *pool) {
+    for (size_t i = 0; i < pool->count; i++) {
+        free(pool->buffers[i]);
+    }
+    free(pool->buffers);
+    pool->buffers = NULL;
+    pool->count = 0;
+}
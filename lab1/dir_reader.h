@@ -0,0 +1,53 @@
+#ifndef DIR_READER_H
+#define DIR_READER_H
+
+#include <dirent.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define READER_READDIR 0
+#define READER_GETDENTS 1
+
+#define DEFAULT_DIR_BUFFER_SIZE (256 * 1024)
+
+typedef struct DirRecord {
+    const char *name;
+    unsigned char type;
+    uint64_t ino;
+} DirRecord;
+
+/* Either a glibc DIR stream or raw getdents64 into a caller-owned buffer.
+ * Records point into the buffer and stay valid until the next refill. */
+typedef struct DirReader {
+    int backend;
+    int fd;
+    DIR *dir;
+    char *buffer;
+    size_t buffer_size;
+    size_t pos;
+    size_t len;
+    int failed;
+} DirReader;
+
+/* Reusable getdents64 buffers, indexed by the reader using them: the
+ * sequential walker takes one per reader still open on its explicit stack
+ * (a parent may still be read while a child is open), a -j worker its
+ * own single buffer. */
+typedef struct DirBufferPool {
+    char **buffers;
+    size_t count;
+    size_t size;
+} DirBufferPool;
+
+/* Takes ownership of fd. Returns -1 and closes it on failure. */
+int dir_reader_open(DirReader *reader, int fd, int backend, char *buffer, size_t buffer_size);
+/* Returns 1 with *record filled, 0 at the end of the directory, -1 on error,
+ * which also sets failed for callers that only see the records. */
+int dir_reader_next(DirReader *reader, DirRecord *record);
+int dir_reader_fd(const DirReader *reader);
+void dir_reader_close(DirReader *reader);
+
+char *dir_buffer_get(DirBufferPool *pool, size_t index);
+void dir_buffer_free(DirBufferPool *pool);
+
+#endif
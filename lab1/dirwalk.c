@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -7,98 +9,694 @@
 #include <limits.h>
 #include <locale.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include "array_entries.h"
+#include "walk_options.h"
+#include "parallel_walk.h"
+#include "classify.h"
+#include "dir_reader.h"
+#include "output.h"
+#include "entry_sort.h"
+#include "spill.h"
+#include "tree_index.h"
+#include "watch.h"
+#include "path_buffer.h"
+#include "inode_set.h"
+#include "predicate.h"
+#include "aggregate.h"
+#include "walk_stats.h"
+#include "dupes.h"
+#include "diff.h"
 
-void add_entry(ArrayEntries *array, char* full_path, int flag) {
-    array->size++;
-    array->entries = (Map*)realloc(array->entries, array->size * sizeof(Map));
-    if (!array->entries) {
+#define WALK_MARKER -2
+
+/* A directory on the explicit stack. Its reader is closed as soon as the
+ * last batch is read and every subdirectory in it has been opened, so a
+ * long chain of single-child directories keeps O(1) fds open. */
+typedef struct WalkFrame {
+    DirReader reader;
+    size_t path_len;
+    size_t depth;
+    uint32_t dir;
+    size_t names_base;
+    size_t dirs_pending;
+    int open;
+    int exhausted;
+    DirTotals totals;
+    STATS_FIELD(uint64_t stats_ticks)
+    STATS_FIELD(uint64_t stats_entries)
+} WalkFrame;
+
+/* Entries still to visit, pushed in reverse so the top is the next one in
+ * readdir order. A marker below each batch reads the directory's next
+ * batch, or pops its frame once the reader is exhausted. */
+typedef struct StackItem {
+    int flag;
+    int emit;
+    int descend;
+    size_t frame;
+    size_t name;
+} StackItem;
+
+typedef struct WalkState {
+    const WalkOptions *options;
+    EntrySink *sink;
+    WalkCounters *counters;
+    DirBufferPool buffers;
+    EntryBatch batch;
+    StatRing *ring;
+    InodeSet *visited;
+    dev_t root_dev;
+    PathBuffer path;
+    WalkFrame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    StackItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    EntryStats *item_stats;
+    size_t item_stats_capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    size_t open_readers;
+    STATS_FIELD(uint64_t open_ticks)
+} WalkState;
+
+static void *grow(void *ptr, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return ptr;
+    }
+    size_t count = *capacity ? *capacity : 64;
+    while (count < needed) {
+        count *= 2;
+    }
+    ptr = realloc(ptr, count * item_size);
+    if (!ptr) {
         perror("realloc");
         exit(EXIT_FAILURE);
     }
-    array->entries[array->size - 1].entry = strdup(full_path);
-    array->entries[array->size - 1].flag = flag;
+    *capacity = count;
+    return ptr;
 }
 
-int compare_for_sorting(const void *a, const void *b) {
-    return strcoll(((Map *)a)->entry, ((Map *)b)->entry);
+static void push_item(WalkState *state, int flag, int emit, int descend, size_t frame, size_t name) {
+    state->items = (StackItem*)grow(state->items, &state->item_capacity, state->item_count + 1, sizeof(StackItem));
+    StackItem *item = &state->items[state->item_count++];
+    item->flag = flag;
+    item->emit = emit;
+    item->descend = descend;
+    item->frame = frame;
+    item->name = name;
 }
 
-void dirwalk(const char *dir_path, int flag_links, int flag_dirs, int flag_files, ArrayEntries *array_entries, int *entry_count) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        perror("opendir");
-        return;
+static size_t push_name(WalkState *state, const char *name) {
+    size_t offset = state->names_size;
+    size_t len = strlen(name) + 1;
+    state->names = (char*)grow(state->names, &state->names_capacity, offset + len, 1);
+    memcpy(state->names + offset, name, len);
+    state->names_size += len;
+    return offset;
+}
+
+static void close_frame(WalkState *state, WalkFrame *frame) {
+    if (frame->open) {
+        STATS_START(state->options->stats, close_start);
+        dir_reader_close(&frame->reader);
+        STATS_END(state->options->stats, PHASE_CLOSE, close_start);
+        frame->open = 0;
+        state->open_readers--;
     }
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+/* -s order on the stack: an item's token is its name followed by '/' when
+ * it is a directory to descend into and by the terminator when it is an
+ * entry to emit. Sorted descending, so the smallest is on top. */
+static int compare_tokens(const void *a, const void *b, void *names) {
+    const StackItem *x = (const StackItem*)a, *y = (const StackItem*)b;
+    return path_component_compare((const char*)names + y->name, y->descend ? '/' : '\0',
+                                  (const char*)names + x->name, x->descend ? '/' : '\0');
+}
+
+/* Reads one batch of the frame's directory and pushes the entries that
+ * are emitted or descended into. */
+static void queue_batch(WalkState *state, size_t frame_index) {
+    const WalkOptions *options = state->options;
+    WalkFrame *frame = &state->frames[frame_index];
+    EntryBatch *batch = &state->batch;
+    STATS_START(options->stats, read_start);
+    size_t count = batch_fill(batch, &frame->reader);
+    STATS_END_ADD(options->stats, PHASE_READ, read_start, frame->stats_ticks);
+    STATS_DO(frame->stats_entries += count);
+    frame->exhausted = count < batch->capacity;
+    if (count > 0) {
+        STATS_START(options->stats, classify_start);
+        batch_classify(batch, dir_reader_fd(&frame->reader), options->stat_mask, &state->ring, state->counters);
+        if (options->follow_links) {
+            batch_follow_links(batch, dir_reader_fd(&frame->reader), options->stat_mask, state->counters);
+        }
+        STATS_END_ADD(options->stats, PHASE_CLASSIFY, classify_start, frame->stats_ticks);
+    }
+    STATS_START(options->stats, filter_start);
+    const Predicate *predicate = options->predicate;
+    int needs_path = predicate && predicate_needs_path(predicate);
+    int stats_valid = predicate && (options->stat_mask & predicate_stat_mask(predicate)) == predicate_stat_mask(predicate);
+    if (needs_path) {
+        path_truncate(&state->path, frame->path_len);
+    }
+    for (size_t i = count; i-- > 0;) {
+        int flag = batch->flags[i];
+        if (flag == -1)
             continue;
-        char full_path[PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-        struct stat file_stat;
-        if (lstat(full_path, &file_stat) == -1) {
-            perror("lstat");
+        int emit = should_emit(options, flag);
+        int descend = (flag == 2);
+        if (!emit && !descend)
             continue;
+        const char *name = batch_name(batch, i);
+        if (predicate) {
+            if (needs_path) {
+                path_push(&state->path, name);
+            }
+            PredicateEntry entry = {name, state->path.data, frame->depth + 1, flag, dir_reader_fd(&frame->reader),
+                                    options->follow_links, stats_valid ? &batch->stats[i] : NULL};
+            int verdict = predicate_eval(predicate, &entry, state->counters);
+            if (needs_path) {
+                path_truncate(&state->path, frame->path_len);
+            }
+            emit = emit && (verdict & PRED_MATCH);
+            descend = descend && !(verdict & PRED_PRUNE);
         }
-        int flag;
-        if (S_ISLNK(file_stat.st_mode)) {
-            flag = 0;
-        } else if (S_ISREG(file_stat.st_mode)) {
-            flag = 1;
-        } else {
-            flag = 2;
+        if (options->report) {
+            if (emit && flag != 2) {
+                aggregate_entry(options->report, &frame->totals, &batch->stats[i]);
+            }
+            emit = 0;
         }
-
-        if ((flag_links && flag == 0) || (flag_dirs && flag == 2) || (flag_files && flag == 1) || (!flag_links && !flag_dirs && !flag_files)) {
-            add_entry(array_entries, full_path, flag);
+        if (!emit && !descend)
+            continue;
+        size_t name_offset = push_name(state, name);
+        if (options->ordered && emit && descend) {
+            push_item(state, flag, 1, 0, frame_index, name_offset);
+            emit = 0;
+        }
+        push_item(state, flag, emit, descend, frame_index, name_offset);
+        if (options->record_stats) {
+            state->item_stats = (EntryStats*)grow(state->item_stats, &state->item_stats_capacity,
+                                                  state->item_count, sizeof(EntryStats));
+            stats_from_statx(&state->item_stats[state->item_count - 1], &batch->stats[i]);
         }
+        if (descend) {
+            frame->dirs_pending++;
+        }
+    }
+    STATS_END(options->stats, PHASE_FILTER, filter_start);
+}
+
+/* Queues the frame's next batch above a marker that reads the one after
+ * it. With -s ordering the whole directory is read at once and its items
+ * sorted, so the subtree below each entry is finished before the next
+ * entry in collation order comes up. */
+static void read_batch(WalkState *state, size_t frame_index) {
+    push_item(state, WALK_MARKER, 0, 0, frame_index, 0);
+    size_t first = state->item_count;
+    do {
+        queue_batch(state, frame_index);
+    } while (state->options->ordered && !state->frames[frame_index].exhausted);
+    if (state->options->ordered) {
+        qsort_r(state->items + first, state->item_count - first, sizeof(StackItem), compare_tokens, state->names);
+    }
+    WalkFrame *frame = &state->frames[frame_index];
+    if (frame->exhausted && frame->dirs_pending == 0) {
+        close_frame(state, frame);
+    }
+}
+
+/* Takes ownership of fd; path_len is the length of its path in state->path
+ * and dir its node in the sink's PathTable when entries are collected. */
+static void push_frame(WalkState *state, int fd, size_t path_len, size_t depth, uint32_t dir) {
+    const WalkOptions *options = state->options;
+    char *buffer = (options->reader == READER_GETDENTS) ? dir_buffer_get(&state->buffers, state->open_readers) : NULL;
+    state->frames = (WalkFrame*)grow(state->frames, &state->frame_capacity, state->frame_count + 1, sizeof(WalkFrame));
+    WalkFrame *frame = &state->frames[state->frame_count];
+    if (dir_reader_open(&frame->reader, fd, options->reader, buffer, options->buffer_size) == -1) {
+        return;
+    }
+    frame->path_len = path_len;
+    frame->depth = depth;
+    frame->dir = dir;
+    frame->names_base = state->names_size;
+    frame->dirs_pending = 0;
+    frame->open = 1;
+    frame->exhausted = 0;
+    memset(&frame->totals, 0, sizeof(frame->totals));
+    STATS_DO(frame->stats_ticks = state->open_ticks);
+    STATS_DO(frame->stats_entries = 0);
+    if (options->report) {
+        aggregate_dir(&frame->totals, fd);
+    }
+    state->open_readers++;
+    read_batch(state, state->frame_count++);
+}
 
-        if (flag == 2) {
-            dirwalk(full_path, flag_links, flag_dirs, flag_files, array_entries, entry_count);
+/* -x: whether the directory open at fd is on the start directory's
+ * filesystem. One that cannot be fstat'ed counts as on it, so the walk
+ * still reports its errors. */
+static int on_root_device(const WalkState *state, int fd) {
+    struct stat st;
+    return fstat(fd, &st) != 0 || st.st_dev == state->root_dev;
+}
+
+/* Depth-first walk driven by an explicit stack; the output order is the
+ * readdir order of each directory with children visited right after their
+ * own entry, as a recursive walk would produce. Takes ownership of dir_fd. */
+void dirwalk(int dir_fd, const char *dir_path, WalkState *state) {
+    const WalkOptions *options = state->options;
+    PathBuffer *path = &state->path;
+    path_set(path, dir_path);
+    if (state->visited) {
+        inode_set_visit(state->visited, dir_fd);
+    }
+    struct stat root;
+    if (options->one_filesystem && fstat(dir_fd, &root) == 0) {
+        state->root_dev = root.st_dev;
+    }
+    ArrayEntries *array = state->sink->array;
+    push_frame(state, dir_fd, path->len, 0, array ? path_table_dir(&array->paths, path->data, path->len) : PATH_NO_DIR);
+    while (state->item_count > 0) {
+        StackItem item = state->items[--state->item_count];
+        WalkFrame *frame = &state->frames[item.frame];
+        if (item.flag == WALK_MARKER) {
+            if (frame->exhausted) {
+                close_frame(state, frame);
+                path_truncate(path, frame->path_len);
+                STATS_DIR(options->stats, path->data, frame->depth, frame->stats_entries, frame->stats_ticks);
+                if (options->report) {
+                    aggregate_report_dir(options->report, path->data, frame->depth, &frame->totals);
+                    if (state->frame_count > 1) {
+                        totals_merge(&state->frames[state->frame_count - 2].totals, &frame->totals);
+                    }
+                }
+                state->names_size = frame->names_base;
+                state->frame_count--;
+                if (state->sink->out) {
+                    output_tick(state->sink->out);
+                }
+            } else {
+                read_batch(state, item.frame);
+            }
+            continue;
+        }
+        const char *name = state->names + item.name;
+        path_truncate(path, frame->path_len);
+        path_push(path, name);
+        if (item.emit) {
+            STATS_START(options->stats, emit_start);
+            sink_entry_at(state->sink, frame->dir, name, path->data, item.flag,
+                          options->record_stats ? &state->item_stats[state->item_count] : NULL);
+            STATS_END(options->stats, PHASE_EMIT, emit_start);
+        }
+        if (item.descend) {
+            STATS_START(options->stats, open_start);
+            int child_fd = open_dir_at(dir_reader_fd(&frame->reader), name, options->follow_links);
+            STATS_DO(state->open_ticks = 0);
+            STATS_END_ADD(options->stats, PHASE_OPEN, open_start, state->open_ticks);
+            if (child_fd != -1 && state->visited && !inode_set_visit(state->visited, child_fd)) {
+                close(child_fd);
+                child_fd = -1;
+                state->counters->revisits++;
+            }
+            if (child_fd != -1 && options->one_filesystem && !on_root_device(state, child_fd)) {
+                close(child_fd);
+                child_fd = -1;
+                state->counters->other_fs++;
+            }
+            frame->dirs_pending--;
+            if (frame->exhausted && frame->dirs_pending == 0) {
+                close_frame(state, frame);
+            }
+            if (!options->ordered) {
+                state->names_size = item.name;
+            }
+            if (child_fd != -1) {
+                uint32_t child_dir = array ? path_table_child(&array->paths, frame->dir, name, strlen(name)) : PATH_NO_DIR;
+                push_frame(state, child_fd, path->len, frame->depth + 1, child_dir);
+            }
+        } else if (!options->ordered) {
+            state->names_size = item.name;
         }
     }
-    closedir(dir);
+}
+
+static void free_walk_state(WalkState *state) {
+    dir_buffer_free(&state->buffers);
+    batch_free(&state->batch);
+    stat_ring_destroy(state->ring);
+    inode_set_destroy(state->visited);
+    path_free(&state->path);
+    free(state->frames);
+    free(state->items);
+    free(state->item_stats);
+    free(state->names);
+}
+
+/* find's rule: the directories end at the first argument that starts an
+ * expression. */
+static int starts_expression(const char *arg) {
+    return (arg[0] == '-' && arg[1] != '\0') || strcmp(arg, "(") == 0 || strcmp(arg, "!") == 0;
 }
 
 int main(int argc, char *argv[]) {
     setlocale(LC_COLLATE, "");
-    int flag_links = 0, flag_dirs = 0, flag_files = 0, sort_output = 0;
-    ArrayEntries array_entries = {0, NULL};
-    int entry_count = 0;
+    WalkOptions options = {.threads = 1, .remote_threads = DEFAULT_REMOTE_THREADS, .reader = READER_READDIR, .buffer_size = DEFAULT_DIR_BUFFER_SIZE};
+    int sort_output = 0, verbose = 0, watch = 0, aggregate = 0, dupes = 0, diff = 0, format = OUTPUT_TEXT, stats_format = -1;
+    size_t aggregate_depth = SIZE_MAX, aggregate_top = 0;
+    size_t sort_budget = 0;
+    const char *tmp_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    const char *index_path = NULL;
+    IndexStats index_stats = {0, 0, 0, 0, 0.0};
+    WalkCounters counters = {0, 0, 0, 0, 0, 0, 0};
+    ArrayEntries array_entries;
+    memset(&array_entries, 0, sizeof(array_entries));
+    static const struct option long_options[] = {
+        {"watch", no_argument, NULL, 'W'},
+        {"stats", optional_argument, NULL, 'P'},
+        {"dupes", no_argument, NULL, 'U'},
+        {"diff", no_argument, NULL, 'E'},
+        {NULL, 0, NULL, 0}
+    };
     int opt;
 
-    while ((opt = getopt(argc, argv, "ldfs")) != -1) {
+    while ((opt = getopt_long(argc, argv, "+ldfsvgSuiLxAB0j:J:b:M:T:I:D:N:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'l': 
-                flag_links = 1; 
+                options.flag_links = 1; 
                 break;
             case 'd': 
-                flag_dirs = 1; 
+                options.flag_dirs = 1; 
                 break;
             case 'f': 
-                flag_files = 1; 
+                options.flag_files = 1; 
                 break;
             case 's': 
                 sort_output = 1; 
                 break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'g':
+                options.reader = READER_GETDENTS;
+                break;
+            case 'b':
+                options.buffer_size = (size_t)atol(optarg) * 1024;
+                if (options.buffer_size < 4096) {
+                    fprintf(stderr, "Invalid buffer size: %s KiB\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                options.stat_mask = STATX_BASIC_STATS;
+                break;
+            case 'u':
+                options.use_uring = 1;
+                break;
+            case 'i':
+                options.inode_order = 1;
+                break;
+            case 'L':
+                options.follow_links = 1;
+                break;
+            case 'x':
+                options.one_filesystem = 1;
+                break;
+            case 'A':
+                aggregate = 1;
+                break;
+            case 'B':
+                format = OUTPUT_BINARY;
+                break;
+            case '0':
+                format = OUTPUT_NUL;
+                break;
+            case 'D':
+            case 'N': {
+                char *end;
+                long long value = strtoll(optarg, &end, 10);
+                if (end == optarg || *end || value < (opt == 'N')) {
+                    fprintf(stderr, "Invalid %s: %s\n", (opt == 'D') ? "depth" : "count", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                *((opt == 'D') ? &aggregate_depth : &aggregate_top) = (size_t)value;
+                break;
+            }
+            case 'j':
+            case 'J':
+                *((opt == 'j') ? &options.threads : &options.remote_threads) = atoi(optarg);
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                sort_budget = (size_t)atol(optarg) * 1024 * 1024;
+                if (sort_budget == 0) {
+                    fprintf(stderr, "Invalid sort memory budget: %s MiB\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                tmp_dir = optarg;
+                break;
+            case 'I':
+                index_path = optarg;
+                break;
+            case 'W':
+                watch = 1;
+                break;
+            case 'U':
+                dupes = 1;
+                break;
+            case 'E':
+                diff = 1;
+                break;
+            case 'P':
+                if (optarg && strcmp(optarg, "json") != 0 && strcmp(optarg, "text") != 0) {
+                    fprintf(stderr, "Invalid --stats format: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                stats_format = optarg && strcmp(optarg, "json") == 0;
+                break;
             default: 
-                fprintf(stderr, "Usage: %s [-l] [-d] [-f] [-s] [directory]\n", argv[0]); 
+                fprintf(stderr, "Usage: %s [-l] [-d] [-f] [-s] [-v] [-g] [-b KiB] [-S] [-u] [-i] [-L] [-x] [-0 | -B] [-A [-D depth] [-N count]] [-j threads [-J threads]] [-M MiB] [-T tmpdir] [-I index] [--watch] [--stats[=json]] [--dupes] [--diff A B] [directory... [expression]]\n", argv[0]); 
                 exit(EXIT_FAILURE);
         }
     }  
-    const char *start_dir = (optind < argc) ? argv[optind] : ".";
-    dirwalk(start_dir, flag_links, flag_dirs, flag_files, &array_entries, &entry_count);
-    if (sort_output) {
-        qsort(array_entries.entries, array_entries.size, sizeof(Map), compare_for_sorting);
-    }
-    for (int i = 0; i < array_entries.size; i++) {
-        printf("%s: %s\n", (array_entries.entries[i].flag == 0) ? "Symlink" :
-                           (array_entries.entries[i].flag == 1) ? "File" : "Directory",
-                           array_entries.entries[i].entry);
-        free(array_entries.entries[i].entry);
-    }
-    free(array_entries.entries);
-    return 0;
+    raise_fd_limit();
+    if (options.use_uring) {
+        StatRing *probe = stat_ring_create(STAT_RING_ENTRIES);
+        if (!probe) {
+            fprintf(stderr, "io_uring unavailable, using synchronous statx\n");
+            options.use_uring = 0;
+        }
+        stat_ring_destroy(probe);
+    }
+    static const char *default_roots[] = {"."};
+    const char **roots = (const char**)argv + optind;
+    int root_count = 0;
+    while (optind + root_count < argc && !starts_expression(argv[optind + root_count])) {
+        root_count++;
+    }
+    int expression = optind + root_count;
+    if (root_count == 0) {
+        roots = default_roots;
+        root_count = 1;
+    }
+    const char *start_dir = roots[0];
+    Predicate *predicate = NULL;
+    if (expression < argc) {
+        predicate = predicate_compile(argc - expression, argv + expression);
+        if (!predicate) {
+            exit(EXIT_FAILURE);
+        }
+        options.predicate = predicate;
+    }
+    options.record_stats = (format == OUTPUT_BINARY && options.stat_mask);
+    if (options.record_stats && (sort_output || index_path)) {
+        fprintf(stderr, "-B -S cannot be combined with -s or -I\n");
+        exit(EXIT_FAILURE);
+    }
+    if (aggregate && format != OUTPUT_TEXT) {
+        fprintf(stderr, "-A prints text totals; -0 and -B do not apply\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dupes && (aggregate || sort_output || format != OUTPUT_TEXT)) {
+        fprintf(stderr, "--dupes prints text groups; -A, -s, -0 and -B do not apply\n");
+        exit(EXIT_FAILURE);
+    }
+    if (diff && (root_count != 2 || predicate || aggregate || dupes || sort_output || index_path || watch ||
+                 format == OUTPUT_BINARY || options.follow_links || options.one_filesystem)) {
+        fprintf(stderr, "--diff compares exactly two directories; -s, -A, -B, -L, -x, -I, --dupes, --watch and expressions do not apply\n");
+        exit(EXIT_FAILURE);
+    }
+    if (index_path && options.threads > 1) {
+        fprintf(stderr, "-j cannot be combined with -I\n");
+        exit(EXIT_FAILURE);
+    }
+    /* -j keeps every name in its workers until the walk is over, so a
+     * spill budget could not bound its memory. */
+    if (sort_budget && options.threads > 1) {
+        fprintf(stderr, "-M cannot be combined with -j\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((options.follow_links || options.one_filesystem || predicate || aggregate || dupes || root_count > 1) &&
+        (index_path || watch)) {
+        fprintf(stderr, "-L, -x, -A, --dupes, expressions and several directories cannot be combined with -I or --watch\n");
+        exit(EXIT_FAILURE);
+    }
+#ifndef DWALK_STATS
+    if (stats_format >= 0) {
+        fprintf(stderr, "--stats needs an instrumented build: make clean && make STATS=1\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (watch && stats_format >= 0) {
+        fprintf(stderr, "--stats cannot be combined with --watch\n");
+        exit(EXIT_FAILURE);
+    }
+    if (watch) {
+        return watch_mode(start_dir, &options);
+    }
+#ifdef DWALK_STATS
+    WalkStats walk_stats;
+    if (stats_format >= 0) {
+        walk_stats_init(&walk_stats);
+        options.stats = &walk_stats;
+    }
+#endif
+    OutputBuffer out;
+    output_init(&out, STDOUT_FILENO);
+    output_set_format(&out, format, options.record_stats);
+    AggregateReport report;
+    if (aggregate) {
+        aggregate_init(&report, &out, aggregate_depth, aggregate_top);
+        options.report = &report;
+        options.stat_mask |= AGGREGATE_STAT_MASK;
+        sort_output = 0;
+    }
+    /* --dupes only looks at regular files and needs each one's size and
+     * inode, so their stats travel with the entries to the sink. */
+    DupeFinder finder;
+    if (dupes) {
+        dupes_init(&finder, options.threads);
+        options.flag_links = options.flag_dirs = 0;
+        options.flag_files = 1;
+        options.stat_mask |= DUPES_STAT_MASK;
+        options.record_stats = 1;
+    }
+    /* Under bytewise collation the -s order decomposes per directory, so
+     * the walk can produce it directly instead of collecting and sorting;
+     * -I keeps the collecting path, locale collation needs full paths, and
+     * so do several directories, whose entries interleave once sorted.
+     * Only the sequential walk then holds no more than the directories on
+     * its current path; -j keeps every item until parallel_dirwalk() merges. */
+    if (sort_output && !index_path && root_count == 1 && collation_is_bytewise()) {
+        options.ordered = 1;
+        sort_output = 0;
+    }
+    SpillSort spill;
+    EntrySink sink = {sort_output ? &array_entries : NULL, &out, NULL, dupes ? &finder : NULL};
+    if (sort_output && sort_budget) {
+        spill_init(&spill, sort_budget, tmp_dir);
+        sink.spill = &spill;
+    }
+    DiffCounters diff_counters = {0, 0, 0, 0, 0};
+    if (diff) {
+        tree_diff(roots[0], roots[1], &options, &out, &counters, &diff_counters);
+    } else if (index_path) {
+        indexed_dirwalk(start_dir, index_path, &options, &sink, &counters, &index_stats);
+    } else if (options.threads > 1) {
+        parallel_dirwalk(roots, root_count, &options, &sink, &counters);
+    } else {
+        WalkState state;
+        memset(&state, 0, sizeof(state));
+        state.options = &options;
+        state.sink = &sink;
+        state.counters = &counters;
+        state.buffers.size = options.buffer_size;
+        state.batch.inode_order = options.inode_order;
+        if (options.use_uring) {
+            state.ring = stat_ring_create(STAT_RING_ENTRIES);
+        }
+        if (options.follow_links) {
+            state.visited = inode_set_create();
+        }
+        for (int i = 0; i < root_count; i++) {
+            int start_fd = open_dir_at(AT_FDCWD, roots[i], 1);
+            if (start_fd != -1) {
+                dirwalk(start_fd, roots[i], &state);
+            }
+        }
+        free_walk_state(&state);
+    }
+    if (aggregate) {
+        aggregate_finish(&report);
+    }
+    if (dupes) {
+        dupes_finish(&finder, &out);
+    }
+    if (verbose) {
+        fprintf(stderr, "%lu entries, %lu classified from d_type without a stat, %lu statx calls, %lu statx via io_uring\n",
+                counters.entries, counters.stats_avoided, counters.stat_calls, counters.ring_stat_calls);
+        if (options.follow_links) {
+            fprintf(stderr, "%lu directories skipped as already visited\n", counters.revisits);
+        }
+        if (options.one_filesystem) {
+            fprintf(stderr, "%lu directories on other filesystems skipped\n", counters.other_fs);
+        }
+        if (counters.device_pools > 1) {
+            fprintf(stderr, "%lu device worker pools\n", counters.device_pools);
+        }
+        if (dupes) {
+            fprintf(stderr, "dupes: %llu files, %llu sharing a size, %llu partially hashed, %llu fully hashed, %llu byte-compared, %llu bytes read\n",
+                    finder.files_seen, finder.candidates, finder.partial_files, finder.full_files, finder.compared_files,
+                    finder.bytes_read);
+        }
+        if (diff) {
+            fprintf(stderr, "diff: %lu directory pairs compared, %lu skipped as the same directory, %lu entries skipped as the same inode, %lu differences, %lu errors\n",
+                    diff_counters.dirs, diff_counters.same_dirs, diff_counters.linked_entries, diff_counters.differences,
+                    diff_counters.errors);
+        }
+        if (index_path) {
+            fprintf(stderr, "index: %lu directories, %lu re-read, %lu reused from %s; %lu entries replayed without a read or stat, %.3f s\n",
+                    index_stats.dirs, index_stats.reread, index_stats.reused, index_path, index_stats.replayed,
+                    index_stats.seconds);
+        }
+    }
+    STATS_START(options.stats, sort_start);
+    int merged = sink.spill && spill_finish(sink.spill, &array_entries, &out);
+    if (sort_output && !merged) {
+        sort_entries(&array_entries, options.threads);
+    }
+    STATS_END(options.stats, PHASE_SORT, sort_start);
+    STATS_START(options.stats, print_start);
+    PathBuffer entry = {NULL, 0, 0};
+    for (size_t i = 0; i < array_entries.size; i++) {
+        output_entry(&out, array_entries.entries[i].flag, entry_path(&array_entries, i, &entry));
+    }
+    path_free(&entry);
+    output_free(&out);
+    STATS_END(options.stats, PHASE_PRINT, print_start);
+#ifdef DWALK_STATS
+    if (options.stats) {
+        walk_stats_report(options.stats, stderr, stats_format);
+        walk_stats_free(options.stats);
+    }
+#endif
+    free_entries(&array_entries);
+    predicate_free(predicate);
+    /* --diff exits like diff(1): 1 when the trees differ, 2 on trouble. */
+    if (diff && diff_counters.errors > 0) {
+        return 2;
+    }
+    return (diff && diff_counters.differences > 0) ? 1 : 0;
 }
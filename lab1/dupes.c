@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "dupes.h"
+#include "output.h"
+
+#define DUPE_PENDING 0
+#define DUPE_PARTIAL 1
+#define DUPE_WHOLE 2
+#define DUPE_DROPPED 3
+
+/* MurmurHash3 x64_128, fed 16-byte blocks so a file can be hashed one
+ * read buffer at a time. Hashes are only compared within one run. */
+typedef struct Hash128 {
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t len;
+} Hash128;
+
+#define HASH_C1 0x87c37b91114253d5ULL
+#define HASH_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static void hash_init(Hash128 *hash) {
+    hash->h1 = 0;
+    hash->h2 = 0;
+    hash->len = 0;
+}
+
+/* Every call but the last must pass a multiple of 16 bytes. */
+static void hash_update(Hash128 *hash, const unsigned char *data, size_t len) {
+    uint64_t h1 = hash->h1, h2 = hash->h2;
+    size_t blocks = len / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+        k1 *= HASH_C1;
+        k1 = rotl64(k1, 31);
+        k1 *= HASH_C2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+        k2 *= HASH_C2;
+        k2 = rotl64(k2, 33);
+        k2 *= HASH_C1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+    const unsigned char *tail = data + blocks * 16;
+    size_t rest = len & 15;
+    if (rest > 0) {
+        uint64_t k1 = 0, k2 = 0;
+        for (size_t i = rest; i-- > 8;) {
+            k2 = (k2 << 8) | tail[i];
+        }
+        for (size_t i = (rest < 8 ? rest : 8); i-- > 0;) {
+            k1 = (k1 << 8) | tail[i];
+        }
+        if (rest > 8) {
+            k2 *= HASH_C2;
+            k2 = rotl64(k2, 33);
+            k2 *= HASH_C1;
+            h2 ^= k2;
+        }
+        k1 *= HASH_C1;
+        k1 = rotl64(k1, 31);
+        k1 *= HASH_C2;
+        h1 ^= k1;
+    }
+    hash->h1 = h1;
+    hash->h2 = h2;
+    hash->len += len;
+}
+
+static void hash_final(Hash128 *hash, uint64_t out[2]) {
+    uint64_t h1 = hash->h1 ^ hash->len, h2 = hash->h2 ^ hash->len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+void dupes_init(DupeFinder *finder, int threads) {
+    memset(finder, 0, sizeof(*finder));
+    finder->threads = threads;
+}
+
+void dupes_add(DupeFinder *finder, const char *path, const EntryStats *stats) {
+    if (stats->size == 0) {
+        return;
+    }
+    if (finder->count == finder->capacity) {
+        finder->capacity = finder->capacity ? finder->capacity * 2 : 1024;
+        finder->files = (DupeFile*)realloc(finder->files, finder->capacity * sizeof(DupeFile));
+        if (!finder->files) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    DupeFile *file = &finder->files[finder->count++];
+    file->size = stats->size;
+    file->dev = makedev(stats->dev_major, stats->dev_minor);
+    file->ino = stats->ino;
+    file->path = arena_strdup(&finder->paths, path);
+    file->state = DUPE_PENDING;
+    finder->files_seen++;
+}
+
+static int compare_u64(uint64_t a, uint64_t b) {
+    return (a > b) - (a < b);
+}
+
+/* Largest size first, then by inode so hard links end up adjacent. */
+static int compare_identity(const void *a, const void *b) {
+    const DupeFile *x = (const DupeFile*)a, *y = (const DupeFile*)b;
+    int result = compare_u64(y->size, x->size);
+    if (!result)
+        result = compare_u64(x->dev, y->dev);
+    if (!result)
+        result = compare_u64(x->ino, y->ino);
+    return result ? result : strcmp(x->path, y->path);
+}
+
+static int compare_hash(const void *a, const void *b) {
+    const DupeFile *x = (const DupeFile*)a, *y = (const DupeFile*)b;
+    int result = compare_u64(y->size, x->size);
+    if (!result)
+        result = compare_u64(x->hash[0], y->hash[0]);
+    if (!result)
+        result = compare_u64(x->hash[1], y->hash[1]);
+    return result ? result : strcmp(x->path, y->path);
+}
+
+static int same_size(const DupeFile *a, const DupeFile *b) {
+    return a->size == b->size;
+}
+
+static int same_hash(const DupeFile *a, const DupeFile *b) {
+    return a->size == b->size && a->hash[0] == b->hash[0] && a->hash[1] == b->hash[1];
+}
+
+/* After verify_pass(): same hash and the same first identical copy. */
+static int same_content(const DupeFile *a, const DupeFile *b) {
+    return same_hash(a, b) && a->twin == b->twin;
+}
+
+static int compare_content(const void *a, const void *b) {
+    const DupeFile *x = (const DupeFile*)a, *y = (const DupeFile*)b;
+    int result = compare_u64(y->size, x->size);
+    if (!result)
+        result = compare_u64(x->hash[0], y->hash[0]);
+    if (!result)
+        result = compare_u64(x->hash[1], y->hash[1]);
+    if (!result)
+        result = compare_u64(x->twin, y->twin);
+    return result ? result : strcmp(x->path, y->path);
+}
+
+/* Drops every file that is not in a run of at least two matching files;
+ * files must be sorted so that matching ones are adjacent. */
+static void keep_groups(DupeFinder *finder, int (*same)(const DupeFile*, const DupeFile*)) {
+    DupeFile *files = finder->files;
+    size_t kept = 0;
+    for (size_t i = 0; i < finder->count;) {
+        size_t end = i + 1;
+        while (end < finder->count && same(&files[i], &files[end])) {
+            end++;
+        }
+        if (end - i >= 2) {
+            memmove(&files[kept], &files[i], (end - i) * sizeof(DupeFile));
+            kept += end - i;
+        }
+        i = end;
+    }
+    finder->count = kept;
+}
+
+static void drop_failed(DupeFinder *finder) {
+    size_t kept = 0;
+    for (size_t i = 0; i < finder->count; i++) {
+        if (finder->files[i].state != DUPE_DROPPED) {
+            finder->files[kept++] = finder->files[i];
+        }
+    }
+    finder->count = kept;
+}
+
+/* Work of one threaded pass: file indices to hash, or with verify set the
+ * first index of each group to byte-compare. */
+typedef struct HashPass {
+    DupeFinder *finder;
+    size_t *work;
+    size_t count;
+    size_t next;
+    int verify;
+} HashPass;
+
+typedef struct HashWorker {
+    HashPass *pass;
+    unsigned char *buffer;
+    unsigned long long bytes_read;
+} HashWorker;
+
+/* pread() until len bytes are in; a file that shrank is an error too. */
+static int read_fully(int fd, unsigned char *buffer, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buffer, len, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = ESTALE;
+            return -1;
+        }
+        buffer += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* A pending file gets its partial hash, which covers the whole file when
+ * it is at most two edges long; a partial one gets its full hash. */
+static void hash_file(HashWorker *worker, DupeFile *file) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(file->path);
+        file->state = DUPE_DROPPED;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_ino != file->ino || st.st_dev != file->dev ||
+        (uint64_t)st.st_size != file->size) {
+        fprintf(stderr, "%s: changed during the walk\n", file->path);
+        file->state = DUPE_DROPPED;
+        close(fd);
+        return;
+    }
+    Hash128 hash;
+    hash_init(&hash);
+    int failed = 0;
+    if (file->state == DUPE_PENDING && file->size <= 2 * DUPE_EDGE_SIZE) {
+        failed = read_fully(fd, worker->buffer, file->size, 0);
+        hash_update(&hash, worker->buffer, file->size);
+        worker->bytes_read += file->size;
+        file->state = DUPE_WHOLE;
+    } else if (file->state == DUPE_PENDING) {
+        failed = read_fully(fd, worker->buffer, DUPE_EDGE_SIZE, 0) ||
+                 read_fully(fd, worker->buffer + DUPE_EDGE_SIZE, DUPE_EDGE_SIZE, (off_t)(file->size - DUPE_EDGE_SIZE));
+        hash_update(&hash, worker->buffer, 2 * DUPE_EDGE_SIZE);
+        worker->bytes_read += 2 * DUPE_EDGE_SIZE;
+        file->state = DUPE_PARTIAL;
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        for (uint64_t offset = 0; offset < file->size && !failed;) {
+            size_t chunk = (file->size - offset < DUPE_READ_SIZE) ? (size_t)(file->size - offset) : DUPE_READ_SIZE;
+            failed = read_fully(fd, worker->buffer, chunk, (off_t)offset);
+            hash_update(&hash, worker->buffer, chunk);
+            worker->bytes_read += chunk;
+            offset += chunk;
+        }
+        file->state = DUPE_WHOLE;
+    }
+    if (failed) {
+        perror(file->path);
+        file->state = DUPE_DROPPED;
+    }
+    hash_final(&hash, file->hash);
+    close(fd);
+}
+
+/* Returns 1 if both files still hold the same bytes, 0 if they differ.
+ * A file that cannot be read any more is dropped and 0 returned. */
+static int same_bytes(HashWorker *worker, DupeFile *a, DupeFile *b) {
+    int fd_a = open(a->path, O_RDONLY | O_CLOEXEC);
+    if (fd_a == -1) {
+        perror(a->path);
+        a->state = DUPE_DROPPED;
+        return 0;
+    }
+    int fd_b = open(b->path, O_RDONLY | O_CLOEXEC);
+    if (fd_b == -1) {
+        perror(b->path);
+        b->state = DUPE_DROPPED;
+        close(fd_a);
+        return 0;
+    }
+    posix_fadvise(fd_a, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd_b, 0, 0, POSIX_FADV_SEQUENTIAL);
+    unsigned char *buffer_b = worker->buffer + DUPE_READ_SIZE;
+    int same = 1;
+    for (uint64_t offset = 0; offset < a->size && same;) {
+        size_t chunk = (a->size - offset < DUPE_READ_SIZE) ? (size_t)(a->size - offset) : DUPE_READ_SIZE;
+        if (read_fully(fd_a, worker->buffer, chunk, (off_t)offset) == -1) {
+            perror(a->path);
+            a->state = DUPE_DROPPED;
+            same = 0;
+        } else if (read_fully(fd_b, buffer_b, chunk, (off_t)offset) == -1) {
+            perror(b->path);
+            b->state = DUPE_DROPPED;
+            same = 0;
+        } else {
+            same = memcmp(worker->buffer, buffer_b, chunk) == 0;
+        }
+        worker->bytes_read += 2 * chunk;
+        offset += chunk;
+    }
+    close(fd_a);
+    close(fd_b);
+    return same;
+}
+
+/* Splits the group of files sharing a full hash that starts at first into
+ * runs of identical content: each file's twin becomes the index of the
+ * first earlier file with the same bytes, or its own index. Almost always
+ * every file matches the first one. */
+static void verify_group(HashWorker *worker, size_t first) {
+    DupeFinder *finder = worker->pass->finder;
+    DupeFile *files = finder->files;
+    size_t end = first + 1;
+    while (end < finder->count && same_hash(&files[first], &files[end])) {
+        end++;
+    }
+    for (size_t i = first; i < end; i++) {
+        files[i].twin = i;
+        for (size_t k = first; k < i && files[i].state != DUPE_DROPPED; k++) {
+            if (files[k].twin == k && files[k].state != DUPE_DROPPED && same_bytes(worker, &files[k], &files[i])) {
+                files[i].twin = k;
+                break;
+            }
+        }
+    }
+}
+
+static void *hash_worker_main(void *arg) {
+    HashWorker *worker = (HashWorker*)arg;
+    HashPass *pass = worker->pass;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&pass->next, 1, __ATOMIC_RELAXED);
+        if (i >= pass->count)
+            break;
+        if (pass->verify) {
+            verify_group(worker, pass->work[i]);
+        } else {
+            hash_file(worker, &pass->finder->files[pass->work[i]]);
+        }
+    }
+    return NULL;
+}
+
+static int compare_work(const void *a, const void *b, void *files) {
+    const DupeFile *x = (const DupeFile*)files + *(const size_t*)a, *y = (const DupeFile*)files + *(const size_t*)b;
+    int result = compare_u64(x->dev, y->dev);
+    return result ? result : compare_u64(x->ino, y->ino);
+}
+
+static size_t *pass_work(const DupeFinder *finder) {
+    size_t *work = (size_t*)malloc(sizeof(size_t) * (finder->count ? finder->count : 1));
+    if (!work) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return work;
+}
+
+/* Hands pass->work out from a shared counter to finder->threads threads,
+ * each with its own buffer_size buffer. */
+static void run_pass(DupeFinder *finder, HashPass *pass, size_t buffer_size) {
+    int threads = finder->threads;
+    if ((size_t)threads > pass->count)
+        threads = pass->count ? (int)pass->count : 1;
+    HashWorker *workers = (HashWorker*)calloc(threads, sizeof(HashWorker));
+    pthread_t *handles = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    if (!workers || !handles) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < threads; i++) {
+        workers[i].pass = pass;
+        workers[i].buffer = (unsigned char*)malloc(buffer_size);
+        if (!workers[i].buffer) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&handles[i], NULL, hash_worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    hash_worker_main(&workers[0]);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        finder->bytes_read += workers[i].bytes_read;
+        free(workers[i].buffer);
+    }
+    free(workers);
+    free(handles);
+}
+
+/* Hashes every file in state (pending or partial) one step further. Files
+ * are handed out in inode order, which roughly follows their placement
+ * on disk. */
+static unsigned long long hash_pass(DupeFinder *finder, int state) {
+    HashPass pass = {finder, pass_work(finder), 0, 0, 0};
+    for (size_t i = 0; i < finder->count; i++) {
+        if (finder->files[i].state == state) {
+            pass.work[pass.count++] = i;
+        }
+    }
+    qsort_r(pass.work, pass.count, sizeof(size_t), compare_work, finder->files);
+    run_pass(finder, &pass, (state == DUPE_PENDING) ? 2 * DUPE_EDGE_SIZE : DUPE_READ_SIZE);
+    free(pass.work);
+    return pass.count;
+}
+
+/* Byte-compares every group of files sharing a full hash, one group per
+ * thread at a time; files must be sorted by compare_hash(). */
+static void verify_pass(DupeFinder *finder) {
+    HashPass pass = {finder, pass_work(finder), 0, 0, 1};
+    for (size_t i = 0; i < finder->count; i++) {
+        if (i == 0 || !same_hash(&finder->files[i - 1], &finder->files[i])) {
+            pass.work[pass.count++] = i;
+        }
+    }
+    run_pass(finder, &pass, 2 * DUPE_READ_SIZE);
+    free(pass.work);
+    finder->compared_files = finder->count;
+}
+
+static void print_groups(DupeFinder *finder, OutputBuffer *out) {
+    DupeFile *files = finder->files;
+    for (size_t i = 0; i < finder->count;) {
+        char header[64];
+        snprintf(header, sizeof(header), "%llu bytes each:\n", (unsigned long long)files[i].size);
+        output_text(out, header);
+        size_t end = i;
+        while (end < finder->count && same_content(&files[i], &files[end])) {
+            output_text(out, files[end].path);
+            output_text(out, "\n");
+            end++;
+        }
+        output_text(out, "\n");
+        i = end;
+    }
+}
+
+void dupes_finish(DupeFinder *finder, OutputBuffer *out) {
+    qsort(finder->files, finder->count, sizeof(DupeFile), compare_identity);
+    size_t kept = 0;
+    for (size_t i = 0; i < finder->count; i++) {
+        if (kept > 0 && finder->files[kept - 1].size == finder->files[i].size &&
+            finder->files[kept - 1].dev == finder->files[i].dev && finder->files[kept - 1].ino == finder->files[i].ino) {
+            continue;
+        }
+        finder->files[kept++] = finder->files[i];
+    }
+    finder->count = kept;
+    keep_groups(finder, same_size);
+    finder->candidates = finder->count;
+
+    finder->partial_files = hash_pass(finder, DUPE_PENDING);
+    drop_failed(finder);
+    qsort(finder->files, finder->count, sizeof(DupeFile), compare_hash);
+    keep_groups(finder, same_hash);
+
+    finder->full_files = hash_pass(finder, DUPE_PARTIAL);
+    drop_failed(finder);
+    qsort(finder->files, finder->count, sizeof(DupeFile), compare_hash);
+    keep_groups(finder, same_hash);
+
+    verify_pass(finder);
+    drop_failed(finder);
+    qsort(finder->files, finder->count, sizeof(DupeFile), compare_content);
+    keep_groups(finder, same_content);
+
+    print_groups(finder, out);
+    free(finder->files);
+    finder->files = NULL;
+    finder->count = 0;
+    finder->capacity = 0;
+    arena_free(&finder->paths);
+}
@@ -0,0 +1,61 @@
+#ifndef DUPES_H
+#define DUPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "arena.h"
+
+/* statx fields --dupes needs for every file. */
+#define DUPES_STAT_MASK (STATX_TYPE | STATX_SIZE | STATX_INO)
+
+/* Bytes hashed at each end of a file in the partial pass. */
+#define DUPE_EDGE_SIZE 4096
+/* pread() size of the full pass, one buffer per hashing thread. */
+#define DUPE_READ_SIZE (1024 * 1024)
+
+struct EntryStats;
+struct OutputBuffer;
+
+typedef struct DupeFile {
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    const char *path;
+    uint64_t hash[2];
+    size_t twin;
+    int state;
+} DupeFile;
+
+/* --dupes: regular files collected during the walk, then narrowed in
+ * stages so only files that might still be duplicates are read further.
+ * Files whose size is unique are dropped without being opened, the rest
+ * get a hash of their first and last DUPE_EDGE_SIZE bytes, and only the
+ * ones still colliding after that are hashed in full. The hash is not
+ * cryptographic, so files sharing a full hash are finally compared byte
+ * for byte against the first copy and only identical ones are grouped.
+ * A second path to an inode already collected (a hard link) is skipped. */
+typedef struct DupeFinder {
+    DupeFile *files;
+    size_t count;
+    size_t capacity;
+    StringArena paths;
+    int threads;
+    unsigned long long files_seen;
+    unsigned long long candidates;
+    unsigned long long partial_files;
+    unsigned long long full_files;
+    unsigned long long compared_files;
+    unsigned long long bytes_read;
+} DupeFinder;
+
+void dupes_init(DupeFinder *finder, int threads);
+/* Collects one regular file; empty files are ignored. Not thread-safe,
+ * the walkers call it from their single output path. */
+void dupes_add(DupeFinder *finder, const char *path, const struct EntryStats *stats);
+/* Runs the hashing stages on finder->threads threads and prints every
+ * group of identical files, largest size first, as "<size> bytes each:"
+ * followed by one path per line and a blank line. Frees the finder. */
+void dupes_finish(DupeFinder *finder, struct OutputBuffer *out);
+
+#endif
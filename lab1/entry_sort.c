@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <pthread.h>
+#include "entry_sort.h"
+
+#define MIN_ENTRIES_PER_THREAD 16384
+#define INSERTION_SORT_LIMIT 16
+
+typedef struct SortItem {
+    const char *key;
+    Map entry;
+} SortItem;
+
+typedef struct SortJob {
+    const PathTable *paths;
+    SortItem *items;
+    SortItem *scratch;
+    size_t begin;
+    size_t middle;
+    size_t end;
+    int failed;
+    StringArena keys;
+} SortJob;
+
+int compare_for_sorting(const void *a, const void *b, void *context) {
+    SortPaths *sort_paths = (SortPaths*)context;
+    const Map *x = (const Map*)a, *y = (const Map*)b;
+    path_table_path(sort_paths->paths, x->dir, x->name, &sort_paths->a);
+    path_table_path(sort_paths->paths, y->dir, y->name, &sort_paths->b);
+    return strcoll(sort_paths->a.data, sort_paths->b.data);
+}
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(((const SortItem *)a)->key, ((const SortItem *)b)->key);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const Map *)a)->name, ((const Map *)b)->name);
+}
+
+static int compare_node_names(const void *a, const void *b, void *paths) {
+    const PathNode *nodes = ((const PathTable*)paths)->nodes;
+    return path_component_compare(nodes[*(const uint32_t*)a].name, '/', nodes[*(const uint32_t*)b].name, '/');
+}
+
+static inline int key_byte(const SortItem *item, size_t depth) {
+    return (unsigned char)item->key[depth];
+}
+
+static inline void swap_items(SortItem *a, SortItem *b) {
+    SortItem tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* All keys agree up to depth; returns how far they keep agreeing. */
+static size_t common_prefix(const SortItem *items, size_t n, size_t depth) {
+    const char *first = items[0].key;
+    size_t limit = depth + strlen(first + depth);
+    for (size_t i = 1; i < n && limit > depth; i++) {
+        const char *key = items[i].key;
+        size_t j = depth;
+        while (j < limit && key[j] == first[j]) {
+            j++;
+        }
+        limit = j;
+    }
+    return limit;
+}
+
+/* Multikey quicksort (three-way radix quicksort) on the key bytes: shared
+ * path prefixes are examined once per level instead of by every strcmp(). */
+static void radix_sort(SortItem *items, size_t n, size_t depth) {
+    while (n > INSERTION_SORT_LIMIT) {
+        size_t middle = n / 2;
+        int a = key_byte(&items[0], depth), b = key_byte(&items[middle], depth), c = key_byte(&items[n - 1], depth);
+        size_t median = (a < b) ? ((b < c) ? middle : (a < c) ? n - 1 : 0)
+                                : ((a < c) ? 0 : (b < c) ? n - 1 : middle);
+        swap_items(&items[0], &items[median]);
+        int pivot = key_byte(&items[0], depth);
+        size_t lt = 0, i = 1, gt = n;
+        while (i < gt) {
+            int byte = key_byte(&items[i], depth);
+            if (byte < pivot) {
+                swap_items(&items[lt++], &items[i++]);
+            } else if (byte > pivot) {
+                swap_items(&items[i], &items[--gt]);
+            } else {
+                i++;
+            }
+        }
+        if (lt == 0 && gt == n && pivot != 0) {
+            depth = common_prefix(items, n, depth + 1);
+            continue;
+        }
+        radix_sort(items, lt, depth);
+        if (pivot != 0) {
+            radix_sort(items + lt, gt - lt, depth + 1);
+        }
+        items += gt;
+        n -= gt;
+    }
+    for (size_t i = 1; i < n; i++) {
+        SortItem item = items[i];
+        size_t j = i;
+        while (j > 0 && strcmp(items[j - 1].key + depth, item.key + depth) > 0) {
+            items[j] = items[j - 1];
+            j--;
+        }
+        items[j] = item;
+    }
+}
+
+int collation_is_bytewise(void) {
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    return !collate || strcmp(collate, "C") == 0 || strcmp(collate, "POSIX") == 0;
+}
+
+static void *sort_chunk(void *arg) {
+    SortJob *job = (SortJob*)arg;
+    char *buffer = NULL;
+    size_t capacity = 0;
+    PathBuffer path_buffer = {NULL, 0, 0};
+    for (size_t i = job->begin; i < job->end; i++) {
+        path_table_path(job->paths, job->items[i].entry.dir, job->items[i].entry.name, &path_buffer);
+        const char *path = path_buffer.data;
+        errno = 0;
+        size_t len = strxfrm(buffer, path, capacity);
+        if (len >= capacity) {
+            capacity = len + 1 > capacity * 2 ? len + 1 : capacity * 2;
+            buffer = (char*)realloc(buffer, capacity);
+            if (!buffer) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            strxfrm(buffer, path, capacity);
+        }
+        if (errno != 0) {
+            job->failed = 1;
+            break;
+        }
+        job->items[i].key = arena_strdup(&job->keys, buffer);
+    }
+    free(buffer);
+    path_free(&path_buffer);
+    if (!job->failed) {
+        radix_sort(job->items + job->begin, job->end - job->begin, 0);
+    }
+    return NULL;
+}
+
+static void *merge_chunks(void *arg) {
+    SortJob *job = (SortJob*)arg;
+    size_t left = job->begin, right = job->middle, out = job->begin;
+    while (left < job->middle && right < job->end) {
+        if (compare_keys(&job->items[right], &job->items[left]) < 0) {
+            job->scratch[out++] = job->items[right++];
+        } else {
+            job->scratch[out++] = job->items[left++];
+        }
+    }
+    while (left < job->middle) {
+        job->scratch[out++] = job->items[left++];
+    }
+    while (right < job->end) {
+        job->scratch[out++] = job->items[right++];
+    }
+    return NULL;
+}
+
+static void run_jobs(SortJob *jobs, int count, void *(*routine)(void *)) {
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * count);
+    if (!threads) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, routine, &jobs[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    routine(&jobs[0]);
+    for (int i = 1; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+typedef struct TreeFrame {
+    size_t slot;
+    size_t entry;
+    size_t child;
+} TreeFrame;
+
+static size_t node_slot(uint32_t dir) {
+    return (dir == PATH_NO_DIR) ? 0 : (size_t)dir + 1;
+}
+
+/* Bytewise -s order without building a single path: entries are bucketed
+ * by directory and sorted by name inside it, then a depth-first walk of
+ * the PathTable merges each directory's entries (name then terminator)
+ * with its subdirectories (name then '/'), which is exactly strcmp()
+ * order on the materialized paths. Slot 0 stands for PATH_NO_DIR, the
+ * parent of every top component. */
+static void sort_by_tree(ArrayEntries *array) {
+    const PathTable *paths = &array->paths;
+    size_t size = array->size, slots = (size_t)paths->count + 1;
+    size_t *entry_bounds = (size_t*)calloc(slots + 1, sizeof(size_t));
+    size_t *child_bounds = (size_t*)calloc(slots + 1, sizeof(size_t));
+    size_t *cursor = (size_t*)xmalloc(slots * sizeof(size_t));
+    uint32_t *children = (uint32_t*)xmalloc(paths->count * sizeof(uint32_t));
+    Map *grouped = (Map*)xmalloc(size * sizeof(Map));
+    if (!entry_bounds || !child_bounds) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        entry_bounds[node_slot(array->entries[i].dir) + 1]++;
+    }
+    for (uint32_t id = 0; id < paths->count; id++) {
+        child_bounds[node_slot(paths->nodes[id].parent) + 1]++;
+    }
+    for (size_t s = 1; s <= slots; s++) {
+        entry_bounds[s] += entry_bounds[s - 1];
+        child_bounds[s] += child_bounds[s - 1];
+    }
+    memcpy(cursor, entry_bounds, slots * sizeof(size_t));
+    for (size_t i = 0; i < size; i++) {
+        grouped[cursor[node_slot(array->entries[i].dir)]++] = array->entries[i];
+    }
+    memcpy(cursor, child_bounds, slots * sizeof(size_t));
+    for (uint32_t id = 0; id < paths->count; id++) {
+        children[cursor[node_slot(paths->nodes[id].parent)]++] = id;
+    }
+    for (size_t s = 0; s < slots; s++) {
+        if (entry_bounds[s + 1] - entry_bounds[s] > 1) {
+            qsort(grouped + entry_bounds[s], entry_bounds[s + 1] - entry_bounds[s], sizeof(Map), compare_names);
+        }
+        if (child_bounds[s + 1] - child_bounds[s] > 1) {
+            qsort_r(children + child_bounds[s], child_bounds[s + 1] - child_bounds[s], sizeof(uint32_t),
+                    compare_node_names, (void*)paths);
+        }
+    }
+    free(cursor);
+
+    size_t stack_capacity = 64, depth = 1, out = 0;
+    TreeFrame *stack = (TreeFrame*)xmalloc(stack_capacity * sizeof(TreeFrame));
+    stack[0] = (TreeFrame){0, entry_bounds[0], child_bounds[0]};
+    while (depth > 0) {
+        TreeFrame *frame = &stack[depth - 1];
+        int has_entry = frame->entry < entry_bounds[frame->slot + 1];
+        int has_child = frame->child < child_bounds[frame->slot + 1];
+        if (!has_entry && !has_child) {
+            depth--;
+            continue;
+        }
+        if (has_entry && (!has_child || path_component_compare(grouped[frame->entry].name, '\0',
+                                                               paths->nodes[children[frame->child]].name, '/') < 0)) {
+            array->entries[out++] = grouped[frame->entry++];
+            continue;
+        }
+        size_t slot = node_slot(children[frame->child++]);
+        if (depth == stack_capacity) {
+            stack_capacity *= 2;
+            stack = (TreeFrame*)realloc(stack, stack_capacity * sizeof(TreeFrame));
+            if (!stack) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        stack[depth++] = (TreeFrame){slot, entry_bounds[slot], child_bounds[slot]};
+    }
+    free(stack);
+    free(grouped);
+    free(children);
+    free(entry_bounds);
+    free(child_bounds);
+}
+
+void sort_entries(ArrayEntries *array, int threads) {
+    sort_entries_keyed(array, threads, NULL, NULL);
+}
+
+int sort_entries_keyed(ArrayEntries *array, int threads, const char **keys, StringArena *key_arena) {
+    size_t size = array->size;
+    if (size == 0 || (size == 1 && !keys)) {
+        return 1;
+    }
+    if (collation_is_bytewise()) {
+        sort_by_tree(array);
+        for (size_t i = 0; keys && i < size; i++) {
+            keys[i] = NULL;
+        }
+        return 1;
+    }
+    if (threads < 1 || size < (size_t)threads * MIN_ENTRIES_PER_THREAD) {
+        threads = (int)(size / MIN_ENTRIES_PER_THREAD);
+        if (threads < 1) {
+            threads = 1;
+        }
+    }
+    SortItem *items = (SortItem*)malloc(size * sizeof(SortItem));
+    SortJob *jobs = (SortJob*)calloc(threads, sizeof(SortJob));
+    if (!items || !jobs) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < size; i++) {
+        items[i].key = NULL;
+        items[i].entry = array->entries[i];
+    }
+
+    size_t *bounds = (size_t*)malloc(sizeof(size_t) * (threads + 1));
+    if (!bounds) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= threads; i++) {
+        bounds[i] = size * (size_t)i / (size_t)threads;
+    }
+    for (int i = 0; i < threads; i++) {
+        jobs[i].paths = &array->paths;
+        jobs[i].items = items;
+        jobs[i].begin = bounds[i];
+        jobs[i].end = bounds[i + 1];
+    }
+    run_jobs(jobs, threads, sort_chunk);
+
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        failed |= jobs[i].failed;
+    }
+    if (failed) {
+        SortPaths sort_paths = {&array->paths, {NULL, 0, 0}, {NULL, 0, 0}};
+        qsort_r(array->entries, size, sizeof(Map), compare_for_sorting, &sort_paths);
+        path_free(&sort_paths.a);
+        path_free(&sort_paths.b);
+        for (size_t i = 0; keys && i < size; i++) {
+            keys[i] = NULL;
+        }
+    } else {
+        SortItem *scratch = (threads > 1) ? (SortItem*)malloc(size * sizeof(SortItem)) : NULL;
+        if (threads > 1 && !scratch) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (int width = 1; width < threads; width *= 2) {
+            int merges = 0;
+            for (int i = 0; i < threads; i += 2 * width) {
+                SortJob *job = &jobs[merges++];
+                job->items = items;
+                job->scratch = scratch;
+                job->begin = bounds[i];
+                job->middle = bounds[(i + width < threads) ? i + width : threads];
+                job->end = bounds[(i + 2 * width < threads) ? i + 2 * width : threads];
+            }
+            run_jobs(jobs, merges, merge_chunks);
+            SortItem *swap = items;
+            items = scratch;
+            scratch = swap;
+        }
+        free(scratch);
+        for (size_t i = 0; i < size; i++) {
+            array->entries[i] = items[i].entry;
+            if (keys) {
+                keys[i] = items[i].key;
+            }
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (key_arena && !failed) {
+            arena_adopt(key_arena, &jobs[i].keys);
+        } else {
+            arena_free(&jobs[i].keys);
+        }
+    }
+    free(bounds);
+    free(jobs);
+    free(items);
+    return !failed;
+}
@@ -0,0 +1,34 @@
+#ifndef ENTRY_SORT_H
+#define ENTRY_SORT_H
+
+#include "array_entries.h"
+
+/* Scratch for compare_for_sorting(): the table the entries' directories
+ * live in and a buffer for each side. */
+typedef struct SortPaths {
+    const PathTable *paths;
+    PathBuffer a;
+    PathBuffer b;
+} SortPaths;
+
+/* Whether LC_COLLATE is C/POSIX, where strcoll() is strcmp(). */
+int collation_is_bytewise(void);
+
+/* The reference -s order, a qsort_r() comparator on Map entries with a
+ * SortPaths context: strcoll() on the materialized full paths. */
+int compare_for_sorting(const void *a, const void *b, void *context);
+
+/* Sorts array into compare_for_sorting() order. Collation keys are built
+ * once per entry with strxfrm() on its materialized path; when LC_COLLATE
+ * is C/POSIX no path is built at all and entries are compared on the
+ * PathTable nodes. Chunks are sorted and merged on up to threads threads. */
+void sort_entries(ArrayEntries *array, int threads);
+
+/* sort_entries() that also hands back the key of every sorted entry in
+ * keys[i], with the key bytes moved into key_arena. keys[i] is NULL when
+ * the path itself is the key (bytewise collation). Returns 0 when
+ * strxfrm() failed: the array is then in strcoll() order and every
+ * keys[i] is NULL. */
+int sort_entries_keyed(ArrayEntries *array, int threads, const char **keys, StringArena *key_arena);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "inode_set.h"
+
+#define EMPTY_DEV UINT64_MAX
+#define SHARD_INITIAL_CAPACITY 64
+
+typedef struct InodeKey {
+    uint64_t dev;
+    uint64_t ino;
+    const void *owner;
+} InodeKey;
+
+/* Padded to its own cache lines so neighbouring shard locks do not bounce. */
+typedef struct InodeShard {
+    pthread_mutex_t lock;
+    InodeKey *keys;
+    size_t size;
+    size_t capacity;
+} __attribute__((aligned(64))) InodeShard;
+
+struct InodeSet {
+    InodeShard shards[INODE_SET_SHARDS];
+};
+
+static uint64_t hash_key(uint64_t dev, uint64_t ino) {
+    uint64_t hash = (ino ^ (dev * 0x9e3779b97f4a7c15ULL)) * 0xbf58476d1ce4e5b9ULL;
+    return hash ^ (hash >> 31);
+}
+
+static InodeKey *alloc_keys(size_t capacity) {
+    InodeKey *keys = (InodeKey*)malloc(capacity * sizeof(InodeKey));
+    if (!keys) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(keys, 0xff, capacity * sizeof(InodeKey));
+    return keys;
+}
+
+/* Low hash bits pick the slot, high bits the shard. */
+static InodeKey *find_slot(InodeKey *keys, size_t capacity, uint64_t hash, uint64_t dev, uint64_t ino) {
+    size_t mask = capacity - 1;
+    size_t slot = (size_t)hash & mask;
+    while (keys[slot].dev != EMPTY_DEV && (keys[slot].dev != dev || keys[slot].ino != ino)) {
+        slot = (slot + 1) & mask;
+    }
+    return &keys[slot];
+}
+
+static void grow_shard(InodeShard *shard) {
+    size_t capacity = shard->capacity * 2;
+    InodeKey *keys = alloc_keys(capacity);
+    for (size_t i = 0; i < shard->capacity; i++) {
+        InodeKey *key = &shard->keys[i];
+        if (key->dev != EMPTY_DEV) {
+            *find_slot(keys, capacity, hash_key(key->dev, key->ino), key->dev, key->ino) = *key;
+        }
+    }
+    free(shard->keys);
+    shard->keys = keys;
+    shard->capacity = capacity;
+}
+
+InodeSet *inode_set_create(void) {
+    InodeSet *set = (InodeSet*)aligned_alloc(64, sizeof(InodeSet));
+    if (!set) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < INODE_SET_SHARDS; i++) {
+        InodeShard *shard = &set->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->capacity = SHARD_INITIAL_CAPACITY;
+        shard->size = 0;
+        shard->keys = alloc_keys(shard->capacity);
+    }
+    return set;
+}
+
+int inode_set_insert(InodeSet *set, dev_t dev, ino_t ino) {
+    return inode_set_claim(set, dev, ino, NULL, NULL, NULL);
+}
+
+int inode_set_claim(InodeSet *set, dev_t dev, ino_t ino, const void *owner,
+                    int (*precedes)(const void *a, const void *b, void *arg), void *arg) {
+    uint64_t hash = hash_key((uint64_t)dev, (uint64_t)ino);
+    InodeShard *shard = &set->shards[hash >> 58];
+    pthread_mutex_lock(&shard->lock);
+    InodeKey *slot = find_slot(shard->keys, shard->capacity, hash, (uint64_t)dev, (uint64_t)ino);
+    int claimed = slot->dev == EMPTY_DEV;
+    if (claimed) {
+        slot->dev = (uint64_t)dev;
+        slot->ino = (uint64_t)ino;
+        slot->owner = owner;
+        if (++shard->size * 2 > shard->capacity) {
+            grow_shard(shard);
+        }
+    } else if (precedes && precedes(owner, slot->owner, arg)) {
+        slot->owner = owner;
+        claimed = 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return claimed;
+}
+
+int inode_set_visit(InodeSet *set, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return 1;
+    }
+    return inode_set_insert(set, st.st_dev, st.st_ino);
+}
+
+void inode_set_destroy(InodeSet *set) {
+    if (!set) {
+        return;
+    }
+    for (int i = 0; i < INODE_SET_SHARDS; i++) {
+        pthread_mutex_destroy(&set->shards[i].lock);
+        free(set->shards[i].keys);
+    }
+    free(set);
+}
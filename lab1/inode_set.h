@@ -0,0 +1,27 @@
+#ifndef INODE_SET_H
+#define INODE_SET_H
+
+#include <sys/types.h>
+
+#define INODE_SET_SHARDS 64
+
+typedef struct InodeSet InodeSet;
+
+/* Set of (st_dev, st_ino) pairs for directories already entered. The key
+ * hash picks one of INODE_SET_SHARDS open-addressing tables, each behind
+ * its own mutex, so parallel workers rarely contend. */
+InodeSet *inode_set_create(void);
+/* Returns 1 if the pair was not in the set yet (and adds it), 0 otherwise. */
+int inode_set_insert(InodeSet *set, dev_t dev, ino_t ino);
+/* inode_set_insert() for the directory open at fd. An fd that cannot be
+ * fstat'ed counts as new so the walk still reports its errors. */
+int inode_set_visit(InodeSet *set, int fd);
+/* Records owner as the claimant of the pair unless one that precedes it
+ * is recorded already; a claimant that owner precedes is replaced.
+ * Returns 1 if owner holds the pair afterwards. precedes(a, b, arg) runs
+ * under the shard lock. A set is used either with claims or with inserts. */
+int inode_set_claim(InodeSet *set, dev_t dev, ino_t ino, const void *owner,
+                    int (*precedes)(const void *a, const void *b, void *arg), void *arg);
+void inode_set_destroy(InodeSet *set);
+
+#endif
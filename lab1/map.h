@@ -1,4 +1,14 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdint.h>
+
+/* An entry as its directory (a node in the owning array's PathTable) and
+ * its last path component. */
 typedef struct Map {
     int flag;
-    char* entry;
-} Map;
\ No newline at end of file
+    uint32_t dir;
+    const char *name;
+} Map;
+
+#endif
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "spill.h"
+#include "dupes.h"
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void output_init(OutputBuffer *out, int fd) {
+    out->fd = fd;
+    out->format = OUTPUT_TEXT;
+    out->with_stats = 0;
+    out->used = 0;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    out->last_flush_ns = 0;
+    out->data = (char*)malloc(out->capacity);
+    if (!out->data) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void output_flush(OutputBuffer *out) {
+    size_t written = 0;
+    while (written < out->used) {
+        ssize_t n = write(out->fd, out->data + written, out->used - written);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        written += (size_t)n;
+    }
+    out->used = 0;
+    out->last_flush_ns = now_ns();
+}
+
+/* Copies len bytes in, flushing as often as needed, so even a path longer
+ * than the buffer goes out intact. */
+void output_bytes(OutputBuffer *out, const void *data, size_t len) {
+    const char *bytes = (const char*)data;
+    while (len > 0) {
+        if (out->used == out->capacity) {
+            output_flush(out);
+        }
+        size_t chunk = out->capacity - out->used;
+        if (chunk > len)
+            chunk = len;
+        memcpy(out->data + out->used, bytes, chunk);
+        out->used += chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+}
+
+static char *put_le(char *dst, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        dst[i] = (char)(value >> (8 * i));
+    }
+    return dst + size;
+}
+
+void output_set_format(OutputBuffer *out, int format, int with_stats) {
+    out->format = format;
+    out->with_stats = with_stats && format == OUTPUT_BINARY;
+    if (format == OUTPUT_BINARY) {
+        char header[16];
+        memcpy(header, BINARY_MAGIC, 8);
+        put_le(header + 8, BINARY_VERSION, 4);
+        put_le(header + 12, out->with_stats ? BINARY_HAS_STATS : 0, 4);
+        output_bytes(out, header, sizeof(header));
+    }
+}
+
+void stats_from_statx(EntryStats *stats, const struct statx *source) {
+    stats->size = source->stx_size;
+    stats->blocks = source->stx_blocks;
+    stats->mtime_sec = source->stx_mtime.tv_sec;
+    stats->mtime_nsec = source->stx_mtime.tv_nsec;
+    stats->mode = source->stx_mode;
+    stats->ino = source->stx_ino;
+    stats->dev_major = source->stx_dev_major;
+    stats->dev_minor = source->stx_dev_minor;
+    stats->uid = source->stx_uid;
+    stats->gid = source->stx_gid;
+}
+
+static void output_binary(OutputBuffer *out, int flag, const char *path, const EntryStats *stats) {
+    size_t path_len = strlen(path);
+    char record[5 + BINARY_STATS_SIZE];
+    char *ptr = record;
+    *ptr++ = (char)flag;
+    ptr = put_le(ptr, path_len, 4);
+    if (out->with_stats) {
+        static const EntryStats empty;
+        if (!stats)
+            stats = &empty;
+        ptr = put_le(ptr, stats->size, 8);
+        ptr = put_le(ptr, stats->blocks, 8);
+        ptr = put_le(ptr, (uint64_t)stats->mtime_sec, 8);
+        ptr = put_le(ptr, stats->mtime_nsec, 4);
+        ptr = put_le(ptr, stats->mode, 4);
+        ptr = put_le(ptr, stats->ino, 8);
+        ptr = put_le(ptr, stats->dev_major, 4);
+        ptr = put_le(ptr, stats->dev_minor, 4);
+        ptr = put_le(ptr, stats->uid, 4);
+        ptr = put_le(ptr, stats->gid, 4);
+    }
+    output_bytes(out, record, (size_t)(ptr - record));
+    output_bytes(out, path, path_len);
+}
+
+void output_record(OutputBuffer *out, int flag, const char *path, const EntryStats *stats) {
+    if (out->format == OUTPUT_BINARY) {
+        output_binary(out, flag, path, stats);
+        return;
+    }
+    const char *type = (flag == 0) ? "Symlink: " : (flag == 1) ? "File: " : "Directory: ";
+    size_t type_len = strlen(type);
+    size_t path_len = strlen(path);
+    if (out->used + type_len + path_len + 1 > out->capacity) {
+        output_flush(out);
+    }
+    output_bytes(out, type, type_len);
+    output_bytes(out, path, path_len);
+    char end = (out->format == OUTPUT_NUL) ? '\0' : '\n';
+    output_bytes(out, &end, 1);
+}
+
+void output_entry(OutputBuffer *out, int flag, const char *path) {
+    output_record(out, flag, path, NULL);
+}
+
+void output_text(OutputBuffer *out, const char *text) {
+    output_bytes(out, text, strlen(text));
+}
+
+void output_tick(OutputBuffer *out) {
+    if (out->used > 0 && now_ns() - out->last_flush_ns >= OUTPUT_FLUSH_INTERVAL_NS) {
+        output_flush(out);
+    }
+}
+
+void output_free(OutputBuffer *out) {
+    output_flush(out);
+    free(out->data);
+    out->data = NULL;
+}
+
+void sink_entry(EntrySink *sink, const char *path, int flag, const EntryStats *stats) {
+    if (!sink->array) {
+        output_record(sink->out, flag, path, stats);
+        return;
+    }
+    add_entry(sink->array, path, flag);
+    if (sink->spill) {
+        spill_check(sink->spill, sink->array);
+    }
+}
+
+void sink_entry_at(EntrySink *sink, uint32_t dir, const char *name, const char *path, int flag, const EntryStats *stats) {
+    if (sink->dupes) {
+        dupes_add(sink->dupes, path, stats);
+        return;
+    }
+    if (!sink->array) {
+        output_record(sink->out, flag, path, stats);
+        return;
+    }
+    add_entry_at(sink->array, dir, name, flag);
+    if (sink->spill) {
+        spill_check(sink->spill, sink->array);
+    }
+}
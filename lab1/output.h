@@ -0,0 +1,89 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "array_entries.h"
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define OUTPUT_FLUSH_INTERVAL_NS 10000000L
+
+#define OUTPUT_TEXT 0
+#define OUTPUT_NUL 1
+#define OUTPUT_BINARY 2
+
+/* -B stream: a 16-byte header ("DWALKBIN", u32 version, u32 flags), then
+ * per entry a u8 type (0 symlink, 1 file, 2 anything else), a u32 path
+ * length, the 56-byte EntryStats fields in declaration order when flags
+ * has BINARY_HAS_STATS, and the path bytes without a terminator. All
+ * integers are little-endian and records are packed, so a reader can walk
+ * an mmap of the file with fixed offsets and no parsing. */
+#define BINARY_MAGIC "DWALKBIN"
+#define BINARY_VERSION 1
+#define BINARY_HAS_STATS 1
+#define BINARY_STATS_SIZE 56
+
+typedef struct EntryStats {
+    uint64_t size;
+    uint64_t blocks;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint64_t ino;
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint32_t uid;
+    uint32_t gid;
+} EntryStats;
+
+struct statx;
+
+/* Formats entries ("Type: path\n" lines, the same terminated by NUL with
+ * -0, or -B records) into one large buffer and hands it to write(2) when
+ * full, or from output_tick() once the interval has passed so a slow walk
+ * still shows its first lines right away. */
+typedef struct OutputBuffer {
+    int fd;
+    int format;
+    int with_stats;
+    char *data;
+    size_t used;
+    size_t capacity;
+    long last_flush_ns;
+} OutputBuffer;
+
+struct SpillSort;
+struct DupeFinder;
+
+/* Where a walker puts the entries it emits: collected into array when the
+ * output has to be sorted first (spilling sorted runs to disk when spill
+ * is set), handed to dupes with their stats for --dupes, otherwise
+ * streamed straight to out. */
+typedef struct EntrySink {
+    ArrayEntries *array;
+    OutputBuffer *out;
+    struct SpillSort *spill;
+    struct DupeFinder *dupes;
+} EntrySink;
+
+void output_init(OutputBuffer *out, int fd);
+/* Switches to format; OUTPUT_BINARY writes the stream header right away. */
+void output_set_format(OutputBuffer *out, int format, int with_stats);
+void output_entry(OutputBuffer *out, int flag, const char *path);
+/* output_entry() with the entry's stats for -B -S; stats may be NULL
+ * (zeroed fields) and is ignored by the text formats. */
+void output_record(OutputBuffer *out, int flag, const char *path, const EntryStats *stats);
+void stats_from_statx(EntryStats *stats, const struct statx *source);
+void output_text(OutputBuffer *out, const char *text);
+/* Appends len raw bytes, e.g. text that holds NUL terminators. */
+void output_bytes(OutputBuffer *out, const void *data, size_t len);
+void output_tick(OutputBuffer *out);
+void output_flush(OutputBuffer *out);
+void output_free(OutputBuffer *out);
+void sink_entry(EntrySink *sink, const char *path, int flag, const EntryStats *stats);
+/* sink_entry() for a walker that knows its directory's node in
+ * sink->array's PathTable: a collected entry is stored as (dir, name) and
+ * path is only used when streaming. */
+void sink_entry_at(EntrySink *sink, uint32_t dir, const char *name, const char *path, int flag, const EntryStats *stats);
+
+#endif
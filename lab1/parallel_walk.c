@@ -0,0 +1,979 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include "parallel_walk.h"
+#include "dir_reader.h"
+#include "inode_set.h"
+#include "predicate.h"
+#include "aggregate.h"
+#include "walk_stats.h"
+#include "path_buffer.h"
+
+#define MAX_DEVICE_POOLS 64
+/* Past this many entries a directory's stat work is shared: every further
+ * batch is classified in SPLIT_CHUNK-entry pieces by its reader and by any
+ * idle worker of the pool, while readdir stays with the reader. */
+#define SPLIT_DIR_ENTRIES 4096
+#define SPLIT_CHUNK 128
+
+typedef struct DirTask DirTask;
+typedef struct Worker Worker;
+
+/* name is the entry's last component; its directory is the task the item
+ * belongs to, so full paths are only built when the items are merged. */
+typedef struct WalkItem {
+    char *name;
+    int flag;
+    DirTask *child;
+} WalkItem;
+
+/* Keeps a directory fd alive until every queued subdirectory has been
+ * opened relative to it. */
+typedef struct DirHandle {
+    int fd;
+    atomic_int refs;
+} DirHandle;
+
+/* One directory. name is its last component (a start directory's whole
+ * path for a root task) and parent_task the directory it is in, so a full
+ * path is only built by walking up the chain where one is needed. Tasks
+ * live until the merge, so the chain stays valid throughout the walk. Its
+ * readdir results end up in items[first, first + count) of the worker
+ * that processed it. ordinal is its place among its parent's child tasks
+ * in readdir order (a root's index among the roots). dev is its parent's
+ * device (the pool it was queued in) until it is opened, and ino is only
+ * set (identified) with -L; revisit marks a directory a worker left to an
+ * alias earlier in sequential order. fd is set when it was opened by a
+ * worker of another device's pool and handed over. With -A, totals holds
+ * the directory's own entries except hard-linked files, which are left in
+ * links[links_first, links_first + links_count) of the same worker for
+ * merge_task() to count in sequential order. */
+struct DirTask {
+    char *name;
+    DirTask *parent_task;
+    DirHandle *parent;
+    size_t depth;
+    size_t ordinal;
+    dev_t dev;
+    ino_t ino;
+    int identified;
+    int revisit;
+    int fd;
+    Worker *worker;
+    size_t first;
+    size_t count;
+    size_t links_first;
+    size_t links_count;
+    int opened;
+    DirTotals totals;
+};
+
+/* -A: a hard-linked file of a task, to be counted before the task's item
+ * at in the worker's items, where dirwalk() would have counted it. */
+typedef struct LinkItem {
+    AggregateLink link;
+    size_t at;
+} LinkItem;
+
+/* Owner pushes and pops at tail, thieves take from head. */
+typedef struct TaskDeque {
+    pthread_mutex_t lock;
+    DirTask **tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} TaskDeque;
+
+typedef struct ParallelWalk ParallelWalk;
+
+/* A task being replayed by merge_task(): the next of its items to emit
+ * and of its links to count, its PathTable node, the length of its path
+ * in walk->path and, with -A, the totals of its subtree so far. A skipped
+ * task (an -L alias, or one below it) is only walked to free its tasks. */
+typedef struct MergeFrame {
+    DirTask *task;
+    size_t next;
+    size_t next_link;
+    uint32_t dir;
+    size_t path_len;
+    int skip;
+    DirTotals totals;
+} MergeFrame;
+typedef struct DevicePool DevicePool;
+
+/* One batch of a huge directory whose classify work is shared. next is the
+ * first position not handed out yet, done counts finished entries, and
+ * helpers the workers still inside it; it lives on the reader's stack. */
+typedef struct SplitBatch {
+    EntryBatch *batch;
+    int dir_fd;
+    atomic_size_t next;
+    atomic_size_t done;
+    atomic_int helpers;
+} SplitBatch;
+
+struct Worker {
+    int id;
+    pthread_t thread;
+    TaskDeque deque;
+    WalkItem *items;
+    EntryStats *item_stats;
+    size_t items_size;
+    size_t items_capacity;
+    LinkItem *links;
+    size_t links_size;
+    size_t links_capacity;
+    unsigned int seed;
+    WalkCounters counters;
+    DirBufferPool buffers;
+    EntryBatch batch;
+    StatRing *ring;
+    StringArena strings;
+    PathBuffer path;
+    ParallelWalk *walk;
+    DevicePool *pool;
+    STATS_FIELD(WalkStats *stats)
+};
+
+/* The workers of one st_dev. A directory is read by the pool of the device
+ * it lives on and steals only happen within a pool, so every device runs
+ * at its own concurrency and a slow one (NFS, FUSE) only ties up its own
+ * workers. Idle workers sleep on wake until queued is non-zero or split,
+ * the shared batch of a huge directory (under lock), has work left. */
+struct DevicePool {
+    dev_t dev;
+    Worker *workers;
+    int worker_count;
+    atomic_uint next;
+    atomic_size_t queued;
+    atomic_int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    SplitBatch *split;
+};
+
+/* pools[0] is the first start directory's device; the others are created
+ * the first time a worker opens a directory on their device. */
+struct ParallelWalk {
+    const WalkOptions *options;
+    DevicePool *pools[MAX_DEVICE_POOLS];
+    atomic_int pool_count;
+    pthread_mutex_t pools_lock;
+    atomic_size_t pending;
+    InodeSet *visited;
+    InodeSet *expanded;
+    PathBuffer path;
+};
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static void release_handle(DirHandle *handle) {
+    if (handle && atomic_fetch_sub(&handle->refs, 1) == 1) {
+        close(handle->fd);
+        free(handle);
+    }
+}
+
+static DirHandle *share_handle(int dir_fd) {
+    int fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    DirHandle *handle = (DirHandle*)xrealloc(NULL, sizeof(DirHandle));
+    handle->fd = fd;
+    atomic_init(&handle->refs, 1);
+    return handle;
+}
+
+static DirTask *new_task(const char *name, DirTask *parent_task, DirHandle *parent, size_t depth, dev_t dev) {
+    DirTask *task = (DirTask*)xrealloc(NULL, sizeof(DirTask));
+    task->name = strdup(name);
+    if (!task->name) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+    task->parent_task = parent_task;
+    task->parent = parent;
+    task->depth = depth;
+    task->ordinal = 0;
+    task->dev = dev;
+    task->ino = 0;
+    task->identified = 0;
+    task->revisit = 0;
+    task->fd = -1;
+    task->opened = 0;
+    memset(&task->totals, 0, sizeof(task->totals));
+    if (parent) {
+        atomic_fetch_add(&parent->refs, 1);
+    }
+    task->worker = NULL;
+    task->first = 0;
+    task->count = 0;
+    task->links_first = 0;
+    task->links_count = 0;
+    return task;
+}
+
+/* Builds the task's full path into path from the names up its chain, with
+ * no limit on its length. */
+static const char *task_path(const DirTask *task, PathBuffer *path) {
+    size_t len = 0;
+    for (const DirTask *t = task; t; t = t->parent_task) {
+        len += strlen(t->name) + (t->parent_task ? 1 : 0);
+    }
+    path->len = 0;
+    path_reserve(path, len);
+    path->len = len;
+    path->data[len] = '\0';
+    for (const DirTask *t = task; t; t = t->parent_task) {
+        size_t name_len = strlen(t->name);
+        len -= name_len;
+        memcpy(path->data + len, t->name, name_len);
+        if (t->parent_task) {
+            path->data[--len] = '/';
+        }
+    }
+    return path->data;
+}
+
+/* Whether a comes before b in the order merge_task() replays tasks in: an
+ * ancestor before its subtree, siblings in their items' order. */
+static int task_precedes(const void *a, const void *b, void *arg) {
+    const DirTask *x = (const DirTask*)a, *y = (const DirTask*)b;
+    const WalkOptions *options = (const WalkOptions*)arg;
+    while (x->depth > y->depth) {
+        x = x->parent_task;
+    }
+    while (y->depth > x->depth) {
+        y = y->parent_task;
+    }
+    if (x == y) {
+        return ((const DirTask*)a)->depth < ((const DirTask*)b)->depth;
+    }
+    while (x->parent_task != y->parent_task) {
+        x = x->parent_task;
+        y = y->parent_task;
+    }
+    if (options->ordered && x->parent_task) {
+        return path_component_compare(x->name, '/', y->name, '/') < 0;
+    }
+    return x->ordinal < y->ordinal;
+}
+
+/* -L: claims the directory's inode for task. A directory that an earlier
+ * task in sequential order has claimed is left to it, except a root,
+ * which the sequential walk always expands. Which alias is finally
+ * expanded is settled by merge_task(); a task claimed here may still be
+ * superseded by an earlier one reached later. */
+static int claim_dir(ParallelWalk *walk, DirTask *task, const struct stat *st) {
+    task->ino = st->st_ino;
+    task->identified = 1;
+    int claimed = inode_set_claim(walk->visited, st->st_dev, st->st_ino, task, task_precedes, (void*)walk->options);
+    return claimed || !task->parent_task;
+}
+
+static void deque_push(TaskDeque *deque, DirTask *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        if (deque->head > 0) {
+            memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(DirTask*));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        } else {
+            deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+            deque->tasks = (DirTask**)xrealloc(deque->tasks, deque->capacity * sizeof(DirTask*));
+        }
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static DirTask *deque_pop(TaskDeque *deque) {
+    DirTask *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        task = deque->tasks[--deque->tail];
+    }
+    if (deque->tail == deque->head) {
+        deque->head = deque->tail = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static DirTask *deque_steal(TaskDeque *deque) {
+    DirTask *task = NULL;
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL;
+    }
+    if (deque->tail > deque->head) {
+        task = deque->tasks[deque->head++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* Counts the task as queued before it becomes visible, so a thief never
+ * sees queued drop below zero. */
+static void pool_push(DevicePool *pool, Worker *worker, DirTask *task) {
+    atomic_fetch_add(&pool->queued, 1);
+    deque_push(&worker->deque, task);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int split_open(const SplitBatch *split) {
+    return split && atomic_load(&split->next) < split->batch->size;
+}
+
+/* Returns 0 once the walk is over, 1 when the pool may have work. */
+static int wait_for_task(DevicePool *pool, ParallelWalk *walk) {
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleepers, 1);
+    while (atomic_load(&pool->queued) == 0 && !split_open(pool->split) && atomic_load(&walk->pending) > 0) {
+        pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+    int more = atomic_load(&walk->pending) > 0;
+    pthread_mutex_unlock(&pool->lock);
+    return more;
+}
+
+static void wake_all(ParallelWalk *walk) {
+    int count = atomic_load(&walk->pool_count);
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&walk->pools[i]->lock);
+        pthread_cond_broadcast(&walk->pools[i]->wake);
+        pthread_mutex_unlock(&walk->pools[i]->lock);
+    }
+}
+
+/* Network and FUSE filesystems answer each request with a round trip, so
+ * they need more requests in flight (-J) than a local disk (-j). */
+static int is_remote(unsigned long type) {
+    static const uint32_t remote[] = {
+        0x6969,     /* NFS */
+        0x517b,     /* SMB */
+        0xff534d42, /* CIFS */
+        0xfe534d42, /* SMB2 */
+        0x00c36400, /* Ceph */
+        0x01021997, /* 9p */
+        0x65735546, /* FUSE */
+    };
+    for (size_t i = 0; i < sizeof(remote) / sizeof(remote[0]); i++) {
+        if ((uint32_t)type == remote[i])
+            return 1;
+    }
+    return 0;
+}
+
+static int pool_threads(const WalkOptions *options, const struct statfs *fs) {
+    return (fs && is_remote((unsigned long)fs->f_type)) ? options->remote_threads : options->threads;
+}
+
+static void *worker_main(void *arg);
+
+static DevicePool *create_pool(ParallelWalk *walk, dev_t dev, int worker_count) {
+    DevicePool *pool = (DevicePool*)calloc(1, sizeof(DevicePool));
+    Worker *workers = (Worker*)calloc(worker_count, sizeof(Worker));
+    if (!pool || !workers) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pool->dev = dev;
+    pool->workers = workers;
+    pool->worker_count = worker_count;
+    atomic_init(&pool->next, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->sleepers, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    int pool_index = atomic_load(&walk->pool_count);
+    for (int i = 0; i < worker_count; i++) {
+        Worker *worker = &workers[i];
+        worker->id = i;
+        worker->walk = walk;
+        worker->pool = pool;
+        worker->seed = (unsigned int)(pool_index * 1024 + i) * 2654435761u + 1;
+        worker->buffers.size = walk->options->buffer_size;
+        worker->batch.inode_order = walk->options->inode_order;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+#ifdef DWALK_STATS
+        if (walk->options->stats) {
+            worker->stats = (WalkStats*)xrealloc(NULL, sizeof(WalkStats));
+            walk_stats_init(worker->stats);
+        }
+#endif
+    }
+    return pool;
+}
+
+static void start_pool(DevicePool *pool, int first) {
+    for (int i = first; i < pool->worker_count; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* The pool of dev, started on first use with its size picked from the
+ * filesystem of fd. Once MAX_DEVICE_POOLS exist, further devices stay in
+ * fallback. */
+static DevicePool *get_pool(ParallelWalk *walk, dev_t dev, int fd, DevicePool *fallback) {
+    int count = atomic_load(&walk->pool_count);
+    for (int i = 0; i < count; i++) {
+        if (walk->pools[i]->dev == dev)
+            return walk->pools[i];
+    }
+    pthread_mutex_lock(&walk->pools_lock);
+    DevicePool *pool = fallback;
+    count = atomic_load(&walk->pool_count);
+    for (int i = 0; i < count; i++) {
+        if (walk->pools[i]->dev == dev) {
+            pool = walk->pools[i];
+            break;
+        }
+    }
+    if (pool == fallback && count < MAX_DEVICE_POOLS) {
+        struct statfs fs;
+        pool = create_pool(walk, dev, pool_threads(walk->options, fstatfs(fd, &fs) == 0 ? &fs : NULL));
+        walk->pools[count] = pool;
+        atomic_store(&walk->pool_count, count + 1);
+        start_pool(pool, 0);
+    }
+    pthread_mutex_unlock(&walk->pools_lock);
+    return pool;
+}
+
+/* stats is only kept (in item_stats, parallel to items) for -B -S. */
+static void append_item(Worker *self, char *name, int flag, DirTask *child, const struct statx *stats) {
+    if (self->items_size == self->items_capacity) {
+        self->items_capacity = self->items_capacity ? self->items_capacity * 2 : 1024;
+        self->items = (WalkItem*)xrealloc(self->items, self->items_capacity * sizeof(WalkItem));
+        if (stats) {
+            self->item_stats = (EntryStats*)xrealloc(self->item_stats, self->items_capacity * sizeof(EntryStats));
+        }
+    }
+    if (stats) {
+        stats_from_statx(&self->item_stats[self->items_size], stats);
+    }
+    WalkItem *item = &self->items[self->items_size++];
+    item->name = name;
+    item->flag = flag;
+    item->child = child;
+}
+
+static void append_link(Worker *self, const AggregateLink *link, size_t at) {
+    if (self->links_size == self->links_capacity) {
+        self->links_capacity = self->links_capacity ? self->links_capacity * 2 : 256;
+        self->links = (LinkItem*)xrealloc(self->links, self->links_capacity * sizeof(LinkItem));
+    }
+    LinkItem *item = &self->links[self->links_size++];
+    item->link = *link;
+    item->at = at;
+}
+
+/* -s order of a task's items: a subdirectory sorts as its name followed
+ * by '/', an emitted entry as its name alone. */
+static int compare_items(const void *a, const void *b) {
+    const WalkItem *x = (const WalkItem*)a, *y = (const WalkItem*)b;
+    const char *name_x = x->name ? x->name : x->child->name;
+    const char *name_y = y->name ? y->name : y->child->name;
+    return path_component_compare(name_x, x->name ? '\0' : '/', name_y, y->name ? '\0' : '/');
+}
+
+/* Falls back to the full path when the parent fd could not be kept. */
+static int open_task_dir(Worker *self, DirTask *task, int follow) {
+    if (task->parent) {
+        int fd = open_dir_at(task->parent->fd, task->name, follow);
+        release_handle(task->parent);
+        task->parent = NULL;
+        return fd;
+    }
+    if (!task->parent_task) {
+        return open_dir_at(AT_FDCWD, task->name, 1);
+    }
+    return open_dir_at(AT_FDCWD, task_path(task, &self->path), follow);
+}
+
+static void work_split(Worker *self, SplitBatch *split) {
+    const WalkOptions *options = self->walk->options;
+    size_t size = split->batch->size;
+    for (;;) {
+        size_t begin = atomic_fetch_add(&split->next, SPLIT_CHUNK);
+        if (begin >= size)
+            break;
+        size_t end = (size - begin < SPLIT_CHUNK) ? size : begin + SPLIT_CHUNK;
+        batch_classify_range(split->batch, begin, end, split->dir_fd, options->stat_mask, &self->ring, &self->counters);
+        if (options->follow_links) {
+            batch_follow_links_range(split->batch, begin, end, split->dir_fd, options->stat_mask, &self->counters);
+        }
+        atomic_fetch_add(&split->done, end - begin);
+    }
+}
+
+/* An idle worker joins the pool's shared batch; returns 0 if there is none.
+ * Attaching under the lock means the reader, which detaches the batch
+ * under the same lock, only has to wait for helpers already inside. */
+static int help_split(Worker *self) {
+    DevicePool *pool = self->pool;
+    pthread_mutex_lock(&pool->lock);
+    SplitBatch *split = split_open(pool->split) ? pool->split : NULL;
+    if (split) {
+        atomic_fetch_add(&split->helpers, 1);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!split) {
+        return 0;
+    }
+    work_split(self, split);
+    atomic_fetch_sub(&split->helpers, 1);
+    return 1;
+}
+
+/* batch_classify() for a batch of a huge directory, shared with the idle
+ * workers of the pool. If another directory's batch is already shared,
+ * the reader classifies this one alone. */
+static void classify_shared(Worker *self, EntryBatch *batch, int dir_fd) {
+    DevicePool *pool = self->pool;
+    SplitBatch split;
+    split.batch = batch;
+    split.dir_fd = dir_fd;
+    atomic_init(&split.next, 0);
+    atomic_init(&split.done, 0);
+    atomic_init(&split.helpers, 0);
+    batch_share(batch);
+    pthread_mutex_lock(&pool->lock);
+    int posted = !pool->split;
+    if (posted) {
+        pool->split = &split;
+        pthread_cond_broadcast(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    work_split(self, &split);
+    while (atomic_load(&split.done) < batch->size) {
+        sched_yield();
+    }
+    if (posted) {
+        pthread_mutex_lock(&pool->lock);
+        pool->split = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        while (atomic_load(&split.helpers) > 0) {
+            sched_yield();
+        }
+    }
+}
+
+/* Returns 0 when the directory turned out to be on another device and was
+ * handed, still open, to that device's pool; 1 once task is done. */
+static int process_task(Worker *self, DirTask *task) {
+    ParallelWalk *walk = self->walk;
+    task->worker = self;
+    task->first = self->items_size;
+    task->links_first = self->links_size;
+    const WalkOptions *options = walk->options;
+    STATS_DO(uint64_t dir_ticks = 0);
+    STATS_DO(uint64_t dir_entries = 0);
+    int fd = task->fd;
+    if (fd == -1) {
+        STATS_START(self->stats, open_start);
+        fd = open_task_dir(self, task, options->follow_links);
+        STATS_END_ADD(self->stats, PHASE_OPEN, open_start, dir_ticks);
+        if (fd == -1) {
+            return 1;
+        }
+        struct stat st;
+        int have_stat = fstat(fd, &st) == 0;
+        if (walk->visited && have_stat && !claim_dir(walk, task, &st)) {
+            close(fd);
+            task->revisit = 1;
+            return 1;
+        }
+        if (have_stat && st.st_dev != task->dev) {
+            if (options->one_filesystem && task->parent_task) {
+                close(fd);
+                self->counters.other_fs++;
+                return 1;
+            }
+            task->dev = st.st_dev;
+            DevicePool *pool = get_pool(walk, st.st_dev, fd, self->pool);
+            if (pool != self->pool) {
+                task->fd = fd;
+                pool_push(pool, &pool->workers[atomic_fetch_add(&pool->next, 1) % pool->worker_count], task);
+                return 0;
+            }
+        }
+    }
+    DirTotals totals;
+    memset(&totals, 0, sizeof(totals));
+    if (options->report) {
+        aggregate_dir(&totals, fd);
+    }
+    char *buffer = (options->reader == READER_GETDENTS) ? dir_buffer_get(&self->buffers, 0) : NULL;
+    DirReader reader;
+    if (dir_reader_open(&reader, fd, options->reader, buffer, options->buffer_size) == -1) {
+        return 1;
+    }
+    task->opened = 1;
+
+    DirHandle *handle = NULL;
+    int handle_failed = 0;
+    unsigned int predicate_mask = options->predicate ? predicate_stat_mask(options->predicate) : 0;
+    int stats_valid = (options->stat_mask & predicate_mask) == predicate_mask;
+    /* Only -path and -regex look at an entry's full path during the walk;
+     * output paths are built by merge_task() and a child task only needs
+     * its name. */
+    int needs_path = options->predicate && predicate_needs_path(options->predicate);
+    PathBuffer *path = &self->path;
+    size_t path_len = needs_path ? strlen(task_path(task, path)) : 0;
+    EntryBatch *batch = &self->batch;
+    size_t seen = 0;
+    size_t children = 0;
+    for (;;) {
+        STATS_START(self->stats, read_start);
+        size_t count = batch_fill(batch, &reader);
+        STATS_END_ADD(self->stats, PHASE_READ, read_start, dir_ticks);
+        STATS_DO(dir_entries += count);
+        if (count == 0)
+            break;
+        seen += count;
+        /* dirwalk() counts a batch's files before the subdirectories it
+         * queues; with -s the whole directory is one batch. */
+        size_t links_at = options->ordered ? task->first : self->items_size;
+        STATS_START(self->stats, classify_start);
+        if (seen > SPLIT_DIR_ENTRIES && self->pool->worker_count > 1 &&
+            (options->follow_links || batch_needs_stats(batch, options->stat_mask))) {
+            classify_shared(self, batch, dir_reader_fd(&reader));
+        } else {
+            batch_classify(batch, dir_reader_fd(&reader), options->stat_mask, &self->ring, &self->counters);
+            if (options->follow_links) {
+                batch_follow_links(batch, dir_reader_fd(&reader), options->stat_mask, &self->counters);
+            }
+        }
+        STATS_END_ADD(self->stats, PHASE_CLASSIFY, classify_start, dir_ticks);
+        STATS_START(self->stats, filter_start);
+        for (size_t i = 0; i < batch->size; i++) {
+            int flag = batch->flags[i];
+            if (flag == -1)
+                continue;
+            int emit = should_emit(options, flag);
+            int descend = (flag == 2);
+            if (!emit && !descend)
+                continue;
+            if (options->predicate) {
+                if (needs_path) {
+                    path_truncate(path, path_len);
+                    path_push(path, batch_name(batch, i));
+                }
+                PredicateEntry entry = {batch_name(batch, i), needs_path ? path->data : NULL, task->depth + 1, flag, dir_reader_fd(&reader),
+                                        options->follow_links, stats_valid ? &batch->stats[i] : NULL};
+                int verdict = predicate_eval(options->predicate, &entry, &self->counters);
+                emit = emit && (verdict & PRED_MATCH);
+                descend = descend && !(verdict & PRED_PRUNE);
+            }
+            if (options->report) {
+                AggregateLink link;
+                if (emit && flag != 2 && aggregate_linked(&batch->stats[i], &link)) {
+                    append_link(self, &link, links_at);
+                } else if (emit && flag != 2) {
+                    aggregate_entry(options->report, &totals, &batch->stats[i]);
+                }
+                emit = 0;
+            }
+            if (!emit && !descend)
+                continue;
+            char *name = emit ? arena_strdup(&self->strings, batch_name(batch, i)) : NULL;
+            DirTask *child = NULL;
+            if (descend) {
+                if (!handle && !handle_failed) {
+                    handle = share_handle(dir_reader_fd(&reader));
+                    handle_failed = !handle;
+                }
+                child = new_task(batch_name(batch, i), task, handle, task->depth + 1, task->dev);
+                child->ordinal = children++;
+                atomic_fetch_add(&walk->pending, 1);
+                pool_push(self->pool, self, child);
+            }
+            if (options->ordered && name && child) {
+                append_item(self, name, flag, NULL, NULL);
+                name = NULL;
+            }
+            if (name || child) {
+                append_item(self, name, flag, child, options->record_stats ? &batch->stats[i] : NULL);
+            }
+        }
+        STATS_END(self->stats, PHASE_FILTER, filter_start);
+    }
+    STATS_START(self->stats, close_start);
+    dir_reader_close(&reader);
+    STATS_END(self->stats, PHASE_CLOSE, close_start);
+    STATS_DIR(self->stats, task_path(task, &self->path), task->depth, dir_entries, dir_ticks);
+    release_handle(handle);
+    task->count = self->items_size - task->first;
+    task->links_count = self->links_size - task->links_first;
+    if (options->ordered) {
+        qsort(self->items + task->first, task->count, sizeof(WalkItem), compare_items);
+    }
+    task->totals = totals;
+    return 1;
+}
+
+static DirTask *find_task(Worker *self) {
+    DevicePool *pool = self->pool;
+    DirTask *task = deque_pop(&self->deque);
+    if (!task) {
+        int start = rand_r(&self->seed) % pool->worker_count;
+        for (int i = 0; !task && i < pool->worker_count; i++) {
+            int victim = (start + i) % pool->worker_count;
+            if (victim != self->id) {
+                task = deque_steal(&pool->workers[victim].deque);
+            }
+        }
+    }
+    if (task) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return task;
+}
+
+static void *worker_main(void *arg) {
+    Worker *self = (Worker*)arg;
+    ParallelWalk *walk = self->walk;
+    if (walk->options->use_uring) {
+        self->ring = stat_ring_create(STAT_RING_ENTRIES);
+    }
+    for (;;) {
+        DirTask *task = find_task(self);
+        if (!task) {
+            if (!help_split(self) && !wait_for_task(self->pool, walk))
+                break;
+            continue;
+        }
+        if (!process_task(self, task))
+            continue;
+        if (atomic_fetch_sub(&walk->pending, 1) == 1) {
+            wake_all(walk);
+        }
+    }
+    stat_ring_destroy(self->ring);
+    self->ring = NULL;
+    return NULL;
+}
+
+/* -L: whether the sequential walk would expand task here, the first time
+ * its directory comes up in replay order. Roots are always expanded. */
+static int expand_task(ParallelWalk *walk, const DirTask *task, WalkCounters *counters) {
+    if (!walk->expanded) {
+        return 1;
+    }
+    int first = !task->opened || !task->identified || inode_set_insert(walk->expanded, task->dev, task->ino);
+    if (!task->parent_task) {
+        return 1;
+    }
+    if (task->revisit || !first) {
+        counters->revisits++;
+        return 0;
+    }
+    return 1;
+}
+
+/* Puts a task on the merge stack: its node in sink->array's PathTable
+ * (parent_dir is its parent's) and its path in walk->path, unless it is
+ * skipped. */
+static void enter_task(ParallelWalk *walk, MergeFrame **frames, size_t *count, size_t *capacity, DirTask *task,
+                       EntrySink *sink, uint32_t parent_dir, int skip) {
+    uint32_t dir = PATH_NO_DIR;
+    PathBuffer *path = &walk->path;
+    if (!skip) {
+        if (task->parent_task) {
+            path_push(path, task->name);
+        } else {
+            path_set(path, task->name);
+        }
+        if (sink->array) {
+            dir = task->parent_task ? path_table_child(&sink->array->paths, parent_dir, task->name, strlen(task->name))
+                                    : path_table_dir(&sink->array->paths, path->data, path->len);
+        }
+    }
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *frames = (MergeFrame*)xrealloc(*frames, *capacity * sizeof(MergeFrame));
+    }
+    MergeFrame *frame = &(*frames)[(*count)++];
+    frame->task = task;
+    frame->next = 0;
+    frame->dir = dir;
+    frame->path_len = path->len;
+    frame->skip = skip;
+    frame->next_link = 0;
+    frame->totals = task->totals;
+}
+
+/* -A: counts the frame's hard links that dirwalk() would have counted
+ * before the task's item at. */
+static void count_links(ParallelWalk *walk, MergeFrame *frame, size_t at) {
+    DirTask *task = frame->task;
+    if (!walk->options->report || frame->skip || !task->worker) {
+        return;
+    }
+    for (; frame->next_link < task->links_count; frame->next_link++) {
+        const LinkItem *item = &task->worker->links[task->links_first + frame->next_link];
+        if (item->at > at)
+            break;
+        aggregate_link(walk->options->report, &frame->totals, &item->link);
+    }
+}
+
+/* Replays the tree below root into sink in sequential order with an
+ * explicit stack, so its depth is not bounded by the C stack. Frees the
+ * tasks. */
+static void merge_task(ParallelWalk *walk, DirTask *root, EntrySink *sink, WalkCounters *counters) {
+    PathBuffer *path = &walk->path;
+    MergeFrame *frames = NULL;
+    size_t count = 0, capacity = 0;
+    enter_task(walk, &frames, &count, &capacity, root, sink, PATH_NO_DIR, !expand_task(walk, root, counters));
+    while (count > 0) {
+        MergeFrame *frame = &frames[count - 1];
+        DirTask *task = frame->task;
+        if (task->worker && frame->next < task->count) {
+            Worker *worker = task->worker;
+            size_t i = task->first + frame->next++;
+            WalkItem *item = &worker->items[i];
+            count_links(walk, frame, i);
+            uint32_t dir = frame->dir;
+            if (frame->skip) {
+                if (item->child) {
+                    enter_task(walk, &frames, &count, &capacity, item->child, sink, dir, 1);
+                }
+                continue;
+            }
+            path_truncate(path, frame->path_len);
+            STATS_START(walk->options->stats, emit_start);
+            if (item->name && sink->array) {
+                add_entry_ref(sink->array, dir, item->name, item->flag);
+            } else if (item->name) {
+                path_push(path, item->name);
+                sink_entry_at(sink, dir, item->name, path->data, item->flag,
+                              worker->item_stats ? &worker->item_stats[i] : NULL);
+                path_truncate(path, frame->path_len);
+            }
+            STATS_END(walk->options->stats, PHASE_EMIT, emit_start);
+            if (item->child) {
+                enter_task(walk, &frames, &count, &capacity, item->child, sink, dir,
+                           !expand_task(walk, item->child, counters));
+            }
+            continue;
+        }
+        path_truncate(path, frame->path_len);
+        count_links(walk, frame, SIZE_MAX);
+        if (walk->options->report && task->opened && !frame->skip) {
+            aggregate_report_dir(walk->options->report, path->data, task->depth, &frame->totals);
+        }
+        count--;
+        if (count > 0) {
+            path_truncate(path, frames[count - 1].path_len);
+            if (!frame->skip) {
+                totals_merge(&frames[count - 1].totals, &frame->totals);
+            }
+        }
+        free(task->name);
+        free(task);
+    }
+    free(frames);
+}
+
+void parallel_dirwalk(const char *const *roots, int root_count, const WalkOptions *options, EntrySink *sink,
+                      WalkCounters *counters) {
+    ParallelWalk walk;
+    walk.options = options;
+    atomic_init(&walk.pool_count, 0);
+    pthread_mutex_init(&walk.pools_lock, NULL);
+    atomic_init(&walk.pending, root_count);
+    walk.visited = options->follow_links ? inode_set_create() : NULL;
+    walk.expanded = options->follow_links ? inode_set_create() : NULL;
+
+    struct stat st;
+    struct statfs fs;
+    dev_t home_dev = (stat(roots[0], &st) == 0) ? st.st_dev : 0;
+    DevicePool *home = create_pool(&walk, home_dev, pool_threads(options, statfs(roots[0], &fs) == 0 ? &fs : NULL));
+    walk.pools[0] = home;
+    atomic_store(&walk.pool_count, 1);
+    DirTask **root_tasks = (DirTask**)xrealloc(NULL, sizeof(DirTask*) * root_count);
+    for (int i = 0; i < root_count; i++) {
+        root_tasks[i] = new_task(roots[i], NULL, NULL, 0, home_dev);
+        root_tasks[i]->ordinal = (size_t)i;
+        pool_push(home, &home->workers[i % home->worker_count], root_tasks[i]);
+    }
+
+    start_pool(home, 1);
+    worker_main(&home->workers[0]);
+    int pool_count = atomic_load(&walk.pool_count);
+    for (int p = 0; p < pool_count; p++) {
+        DevicePool *pool = walk.pools[p];
+        for (int i = (pool == home); i < pool->worker_count; i++) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+
+    memset(&walk.path, 0, sizeof(walk.path));
+    for (int i = 0; i < root_count; i++) {
+        merge_task(&walk, root_tasks[i], sink, counters);
+    }
+    free(root_tasks);
+    path_free(&walk.path);
+    counters->device_pools += (unsigned long)pool_count;
+    for (int p = 0; p < pool_count; p++) {
+        DevicePool *pool = walk.pools[p];
+        for (int i = 0; i < pool->worker_count; i++) {
+            Worker *worker = &pool->workers[i];
+            add_counters(counters, &worker->counters);
+#ifdef DWALK_STATS
+            if (worker->stats) {
+                walk_stats_merge(options->stats, worker->stats);
+                walk_stats_free(worker->stats);
+                free(worker->stats);
+            }
+#endif
+            if (sink->array) {
+                arena_adopt(&sink->array->strings, &worker->strings);
+            } else {
+                arena_free(&worker->strings);
+            }
+            pthread_mutex_destroy(&worker->deque.lock);
+            free(worker->deque.tasks);
+            free(worker->items);
+            free(worker->item_stats);
+            free(worker->links);
+            dir_buffer_free(&worker->buffers);
+            batch_free(&worker->batch);
+            path_free(&worker->path);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        free(pool->workers);
+        free(pool);
+    }
+    pthread_mutex_destroy(&walk.pools_lock);
+    inode_set_destroy(walk.visited);
+    inode_set_destroy(walk.expanded);
+}
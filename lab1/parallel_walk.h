@@ -0,0 +1,27 @@
+#ifndef PARALLEL_WALK_H
+#define PARALLEL_WALK_H
+
+#include "array_entries.h"
+#include "walk_options.h"
+#include "classify.h"
+#include "output.h"
+
+/* -J default: workers per network or FUSE filesystem. */
+#define DEFAULT_REMOTE_THREADS 16
+
+/* Walks every root and appends entries to sink, root after root, in the
+ * same order the sequential dirwalk() produces. Entries reach the sink
+ * only after the walk finishes, so memory is not bounded: every item of
+ * the tree, -s and -A included, is held in the workers until the merge.
+ * Each device gets its own pool of workers, options->threads for a local
+ * filesystem and options->remote_threads for a network or FUSE one; the
+ * roots are all walked at once, so the pools of different devices make
+ * progress side by side.
+ * Per-worker counters are summed into counters. With -L, when one directory
+ * is reachable by several non-ancestor paths (bind mounts, links to the
+ * same target), the path that gets expanded is the first in sequential
+ * order, as in dirwalk(). */
+void parallel_dirwalk(const char *const *roots, int root_count, const WalkOptions *options, EntrySink *sink,
+                      WalkCounters *counters);
+
+#endif
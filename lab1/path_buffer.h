@@ -0,0 +1,61 @@
+#ifndef PATH_BUFFER_H
+#define PATH_BUFFER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One growing path shared by a whole walk: entering a directory appends
+ * "/name", leaving it truncates back. Not bounded by PATH_MAX since the
+ * kernel only ever sees single names relative to a directory fd. */
+typedef struct PathBuffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+} PathBuffer;
+
+static inline void path_reserve(PathBuffer *path, size_t extra) {
+    if (path->len + extra + 1 <= path->capacity) {
+        return;
+    }
+    size_t capacity = path->capacity ? path->capacity : 4096;
+    while (path->len + extra + 1 > capacity) {
+        capacity *= 2;
+    }
+    path->data = (char*)realloc(path->data, capacity);
+    if (!path->data) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    path->capacity = capacity;
+}
+
+static inline void path_set(PathBuffer *path, const char *text) {
+    path->len = 0;
+    size_t len = strlen(text);
+    path_reserve(path, len);
+    memcpy(path->data, text, len + 1);
+    path->len = len;
+}
+
+/* Appends "/name" to the directory path already in the buffer. */
+static inline void path_push(PathBuffer *path, const char *name) {
+    size_t len = strlen(name);
+    path_reserve(path, len + 1);
+    path->data[path->len] = '/';
+    memcpy(path->data + path->len + 1, name, len + 1);
+    path->len += len + 1;
+}
+
+static inline void path_truncate(PathBuffer *path, size_t len) {
+    path->len = len;
+    path->data[len] = '\0';
+}
+
+static inline void path_free(PathBuffer *path) {
+    free(path->data);
+    path->data = NULL;
+    path->len = path->capacity = 0;
+}
+
+#endif
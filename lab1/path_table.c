@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "path_table.h"
+
+#define EMPTY_SLOT UINT32_MAX
+#define INITIAL_NODES 1024
+
+static uint64_t hash_child(uint32_t parent, const char *name, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ parent;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 29);
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static uint32_t *find_slot(const PathTable *table, uint32_t parent, const char *name, size_t len) {
+    size_t mask = table->slot_count - 1;
+    size_t slot = (size_t)hash_child(parent, name, len) & mask;
+    for (;;) {
+        uint32_t id = table->slots[slot];
+        if (id == EMPTY_SLOT) {
+            return &table->slots[slot];
+        }
+        const PathNode *node = &table->nodes[id];
+        if (node->parent == parent && strncmp(node->name, name, len) == 0 && node->name[len] == '\0') {
+            return &table->slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* Keeps the slots at most half full. */
+static void grow_slots(PathTable *table) {
+    size_t count = table->slot_count ? table->slot_count * 2 : INITIAL_NODES * 2;
+    free(table->slots);
+    table->slots = (uint32_t*)xrealloc(NULL, count * sizeof(uint32_t));
+    memset(table->slots, 0xff, count * sizeof(uint32_t));
+    table->slot_count = count;
+    for (uint32_t id = 0; id < table->count; id++) {
+        const PathNode *node = &table->nodes[id];
+        *find_slot(table, node->parent, node->name, strlen(node->name)) = id;
+    }
+}
+
+uint32_t path_table_child(PathTable *table, uint32_t parent, const char *name, size_t len) {
+    if ((size_t)table->count * 2 >= table->slot_count) {
+        grow_slots(table);
+    }
+    uint32_t *slot = find_slot(table, parent, name, len);
+    if (*slot != EMPTY_SLOT) {
+        return *slot;
+    }
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : INITIAL_NODES;
+        table->nodes = (PathNode*)xrealloc(table->nodes, table->capacity * sizeof(PathNode));
+    }
+    PathNode *node = &table->nodes[table->count];
+    node->name = arena_strndup(&table->names, name, len);
+    node->parent = parent;
+    *slot = table->count;
+    return table->count++;
+}
+
+uint32_t path_table_dir(PathTable *table, const char *path, size_t len) {
+    uint32_t node = PATH_NO_DIR;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i == len || path[i] == '/') {
+            node = path_table_child(table, node, path + start, i - start);
+            start = i + 1;
+        }
+    }
+    return node;
+}
+
+void path_table_path(const PathTable *table, uint32_t dir, const char *name, PathBuffer *out) {
+    size_t name_len = strlen(name);
+    size_t len = name_len;
+    for (uint32_t id = dir; id != PATH_NO_DIR; id = table->nodes[id].parent) {
+        len += strlen(table->nodes[id].name) + 1;
+    }
+    out->len = 0;
+    path_reserve(out, len);
+    char *end = out->data + len;
+    *end = '\0';
+    end -= name_len;
+    memcpy(end, name, name_len);
+    for (uint32_t id = dir; id != PATH_NO_DIR; id = table->nodes[id].parent) {
+        size_t part = strlen(table->nodes[id].name);
+        *--end = '/';
+        end -= part;
+        memcpy(end, table->nodes[id].name, part);
+    }
+    out->len = len;
+}
+
+/* Names hold no '/', so the first differing byte decides. */
+int path_component_compare(const char *a, int sep_a, const char *b, int sep_b) {
+    const unsigned char *x = (const unsigned char*)a, *y = (const unsigned char*)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    int cx = *x ? *x : sep_a, cy = *y ? *y : sep_b;
+    return cx - cy;
+}
+
+void path_table_free(PathTable *table) {
+    free(table->nodes);
+    free(table->slots);
+    arena_free(&table->names);
+    memset(table, 0, sizeof(*table));
+}
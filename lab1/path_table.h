@@ -0,0 +1,43 @@
+#ifndef PATH_TABLE_H
+#define PATH_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "path_buffer.h"
+
+#define PATH_NO_DIR UINT32_MAX
+
+/* One directory component. A path is its ancestors' names joined by '/',
+ * so "/usr/lib" is "" <- "usr" <- "lib" and splitting on '/' and joining
+ * again gives back the exact string. */
+typedef struct PathNode {
+    const char *name;
+    uint32_t parent;
+} PathNode;
+
+/* Directories interned once as (parent, name): entries keep a node id and
+ * their last component instead of a full path, so a shared prefix is
+ * stored a single time however many entries sit below it. */
+typedef struct PathTable {
+    PathNode *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;
+    size_t slot_count;
+    StringArena names;
+} PathTable;
+
+/* Node of name (len bytes, no '/') under parent, added if missing. */
+uint32_t path_table_child(PathTable *table, uint32_t parent, const char *name, size_t len);
+/* Node of the directory path[0, len), interning every component. */
+uint32_t path_table_dir(PathTable *table, const char *path, size_t len);
+/* Materializes dir/name into out. */
+void path_table_path(const PathTable *table, uint32_t dir, const char *name, PathBuffer *out);
+/* Orders two sibling components the way strcmp() orders the paths they
+ * start: each name is followed by sep, '/' when more components come and
+ * '\0' when it is the last one. */
+int path_component_compare(const char *a, int sep_a, const char *b, int sep_b);
+void path_table_free(PathTable *table);
+
+#endif
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <time.h>
+#include "predicate.h"
+
+enum {
+    OP_TRUE,
+    OP_FALSE,
+    OP_NOT,
+    OP_JUMP_FALSE,
+    OP_JUMP_TRUE,
+    OP_NAME,
+    OP_INAME,
+    OP_PATH,
+    OP_REGEX,
+    OP_TYPE,
+    OP_SIZE,
+    OP_MTIME,
+    OP_PRUNE
+};
+
+/* One instruction. Tests set the single result register; jumps read it,
+ * which is all and/or short-circuiting needs. */
+typedef struct PredicateOp {
+    int code;
+    int cmp;
+    long long value;
+    long long unit;
+    char *pattern;
+    regex_t *regex;
+} PredicateOp;
+
+struct Predicate {
+    PredicateOp *ops;
+    size_t count;
+    size_t capacity;
+    size_t min_depth;
+    size_t max_depth;
+    int needs_path;
+    unsigned int stat_mask;
+    time_t now;
+};
+
+typedef struct Parser {
+    Predicate *pred;
+    int argc;
+    char *const *argv;
+    int pos;
+    int failed;
+} Parser;
+
+static size_t emit_op(Predicate *pred, int code) {
+    if (pred->count == pred->capacity) {
+        pred->capacity = pred->capacity ? pred->capacity * 2 : 16;
+        pred->ops = (PredicateOp*)realloc(pred->ops, pred->capacity * sizeof(PredicateOp));
+        if (!pred->ops) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    PredicateOp *op = &pred->ops[pred->count];
+    memset(op, 0, sizeof(*op));
+    op->code = code;
+    return pred->count++;
+}
+
+static const char *peek(const Parser *parser) {
+    return parser->pos < parser->argc ? parser->argv[parser->pos] : NULL;
+}
+
+static const char *take_argument(Parser *parser, const char *primary) {
+    if (parser->pos >= parser->argc) {
+        fprintf(stderr, "Missing argument to %s\n", primary);
+        parser->failed = 1;
+        return NULL;
+    }
+    return parser->argv[parser->pos++];
+}
+
+/* Parses [+-]N[suffix] into cmp and value; unit gets the multiplier of the
+ * suffix (or default_unit without one), and no suffix is allowed when unit
+ * is NULL. Returns 0 on a malformed number. */
+static int parse_number(const char *text, int *cmp, long long *value, long long *unit, long long default_unit) {
+    *cmp = (*text == '+') ? 1 : (*text == '-') ? -1 : 0;
+    if (*cmp != 0)
+        text++;
+    char *end;
+    *value = strtoll(text, &end, 10);
+    if (end == text || *value < 0) {
+        return 0;
+    }
+    if (!unit) {
+        return *end == '\0';
+    }
+    *unit = default_unit;
+    switch (*end) {
+        case '\0': return 1;
+        case 'c': *unit = 1; break;
+        case 'b': *unit = 512; break;
+        case 'k': *unit = 1024LL; break;
+        case 'M': *unit = 1024LL * 1024; break;
+        case 'G': *unit = 1024LL * 1024 * 1024; break;
+        default: return 0;
+    }
+    return end[1] == '\0';
+}
+
+static int parse_depth(Parser *parser, const char *primary, size_t *depth) {
+    const char *arg = take_argument(parser, primary);
+    if (!arg) {
+        return 0;
+    }
+    char *end;
+    long long value = strtoll(arg, &end, 10);
+    if (end == arg || *end || value < 0) {
+        fprintf(stderr, "Invalid argument to %s: %s\n", primary, arg);
+        parser->failed = 1;
+        return 0;
+    }
+    *depth = (size_t)value;
+    return 1;
+}
+
+static void parse_or(Parser *parser);
+
+static void parse_primary(Parser *parser) {
+    Predicate *pred = parser->pred;
+    const char *token = take_argument(parser, "expression");
+    if (!token) {
+        return;
+    }
+    if (strcmp(token, "(") == 0) {
+        parse_or(parser);
+        const char *close = peek(parser);
+        if (!close || strcmp(close, ")") != 0) {
+            fprintf(stderr, "Missing ) in expression\n");
+            parser->failed = 1;
+            return;
+        }
+        parser->pos++;
+        return;
+    }
+    if (strcmp(token, "!") == 0 || strcmp(token, "-not") == 0) {
+        parse_primary(parser);
+        emit_op(pred, OP_NOT);
+        return;
+    }
+    if (strcmp(token, "-true") == 0) {
+        emit_op(pred, OP_TRUE);
+    } else if (strcmp(token, "-false") == 0) {
+        emit_op(pred, OP_FALSE);
+    } else if (strcmp(token, "-prune") == 0) {
+        emit_op(pred, OP_PRUNE);
+    } else if (strcmp(token, "-mindepth") == 0) {
+        parse_depth(parser, token, &pred->min_depth);
+        emit_op(pred, OP_TRUE);
+    } else if (strcmp(token, "-maxdepth") == 0) {
+        parse_depth(parser, token, &pred->max_depth);
+        emit_op(pred, OP_TRUE);
+    } else if (strcmp(token, "-name") == 0 || strcmp(token, "-iname") == 0 || strcmp(token, "-path") == 0) {
+        const char *pattern = take_argument(parser, token);
+        if (!pattern)
+            return;
+        int code = (token[1] == 'n') ? OP_NAME : (token[1] == 'i') ? OP_INAME : OP_PATH;
+        size_t index = emit_op(pred, code);
+        PredicateOp *op = &pred->ops[index];
+        op->pattern = strdup(pattern);
+        if (!op->pattern) {
+            perror("strdup");
+            exit(EXIT_FAILURE);
+        }
+        pred->needs_path |= (code == OP_PATH);
+    } else if (strcmp(token, "-regex") == 0) {
+        const char *pattern = take_argument(parser, token);
+        if (!pattern)
+            return;
+        size_t len = strlen(pattern) + 5;
+        char *anchored = (char*)malloc(len);
+        regex_t *regex = (regex_t*)malloc(sizeof(regex_t));
+        if (!anchored || !regex) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(anchored, len, "^(%s)$", pattern);
+        int error = regcomp(regex, anchored, REG_EXTENDED | REG_NOSUB);
+        free(anchored);
+        if (error != 0) {
+            char message[256];
+            regerror(error, regex, message, sizeof(message));
+            fprintf(stderr, "Invalid -regex %s: %s\n", pattern, message);
+            free(regex);
+            parser->failed = 1;
+            return;
+        }
+        size_t index = emit_op(pred, OP_REGEX);
+        pred->ops[index].regex = regex;
+        pred->needs_path = 1;
+    } else if (strcmp(token, "-type") == 0) {
+        const char *type = take_argument(parser, token);
+        if (!type)
+            return;
+        if (strcmp(type, "l") != 0 && strcmp(type, "f") != 0 && strcmp(type, "d") != 0) {
+            fprintf(stderr, "Invalid argument to -type: %s (expected l, f or d)\n", type);
+            parser->failed = 1;
+            return;
+        }
+        size_t index = emit_op(pred, OP_TYPE);
+        pred->ops[index].value = (*type == 'l') ? 0 : (*type == 'f') ? 1 : 2;
+    } else if (strcmp(token, "-size") == 0 || strcmp(token, "-mtime") == 0 || strcmp(token, "-mmin") == 0) {
+        const char *arg = take_argument(parser, token);
+        if (!arg)
+            return;
+        int size = token[1] == 's';
+        size_t index = emit_op(pred, size ? OP_SIZE : OP_MTIME);
+        PredicateOp *op = &pred->ops[index];
+        long long default_unit = size ? 512 : (token[2] == 't') ? 86400 : 60;
+        op->unit = default_unit;
+        if (!parse_number(arg, &op->cmp, &op->value, size ? &op->unit : NULL, default_unit)) {
+            fprintf(stderr, "Invalid argument to %s: %s\n", token, arg);
+            parser->failed = 1;
+            return;
+        }
+        pred->stat_mask |= size ? STATX_SIZE : STATX_MTIME;
+    } else {
+        fprintf(stderr, "Unknown expression primary: %s\n", token);
+        parser->failed = 1;
+    }
+}
+
+static int ends_and(const char *token) {
+    return !token || strcmp(token, "-o") == 0 || strcmp(token, "-or") == 0 || strcmp(token, ")") == 0;
+}
+
+/* a -a b compiles to: a; JUMP_FALSE end; b; end: */
+static void parse_and(Parser *parser) {
+    parse_primary(parser);
+    while (!parser->failed && !ends_and(peek(parser))) {
+        const char *token = peek(parser);
+        if (strcmp(token, "-a") == 0 || strcmp(token, "-and") == 0) {
+            parser->pos++;
+        }
+        size_t jump = emit_op(parser->pred, OP_JUMP_FALSE);
+        parse_primary(parser);
+        parser->pred->ops[jump].value = (long long)parser->pred->count;
+    }
+}
+
+/* a -o b compiles to: a; JUMP_TRUE end; b; end: */
+static void parse_or(Parser *parser) {
+    parse_and(parser);
+    while (!parser->failed) {
+        const char *token = peek(parser);
+        if (!token || (strcmp(token, "-o") != 0 && strcmp(token, "-or") != 0))
+            break;
+        parser->pos++;
+        size_t jump = emit_op(parser->pred, OP_JUMP_TRUE);
+        parse_and(parser);
+        parser->pred->ops[jump].value = (long long)parser->pred->count;
+    }
+}
+
+Predicate *predicate_compile(int argc, char *const argv[]) {
+    Predicate *pred = (Predicate*)calloc(1, sizeof(Predicate));
+    if (!pred) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pred->max_depth = SIZE_MAX;
+    pred->now = time(NULL);
+    Parser parser = {pred, argc, argv, 0, 0};
+    if (argc > 0) {
+        parse_or(&parser);
+    }
+    if (!parser.failed && parser.pos < argc) {
+        fprintf(stderr, "Unexpected %s in expression\n", argv[parser.pos]);
+        parser.failed = 1;
+    }
+    if (parser.failed) {
+        predicate_free(pred);
+        return NULL;
+    }
+    return pred;
+}
+
+static int compare(long long actual, int cmp, long long value) {
+    return (cmp > 0) ? actual > value : (cmp < 0) ? actual < value : actual == value;
+}
+
+/* Fetches the stat fields the program needs the first time a test asks. */
+static const struct statx *entry_stats(const Predicate *pred, const PredicateEntry *entry,
+                                       struct statx *local, int *fetched, WalkCounters *counters) {
+    if (entry->stats && (entry->stats->stx_mask & pred->stat_mask) == pred->stat_mask) {
+        return entry->stats;
+    }
+    if (!*fetched) {
+        counters->stat_calls++;
+        int flags = entry->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+        if (statx(entry->dir_fd, entry->name, flags, pred->stat_mask, local) == -1) {
+            perror("statx");
+            local->stx_mask = 0;
+        }
+        *fetched = 1;
+    }
+    return (local->stx_mask & pred->stat_mask) == pred->stat_mask ? local : NULL;
+}
+
+int predicate_eval(const Predicate *pred, const PredicateEntry *entry, WalkCounters *counters) {
+    int prune = (entry->depth >= pred->max_depth) ? PRED_PRUNE : 0;
+    if (entry->depth < pred->min_depth || entry->depth > pred->max_depth) {
+        return prune;
+    }
+    struct statx local;
+    int fetched = 0;
+    int result = 1;
+    for (size_t pc = 0; pc < pred->count; pc++) {
+        const PredicateOp *op = &pred->ops[pc];
+        const struct statx *stats;
+        switch (op->code) {
+            case OP_TRUE:
+                result = 1;
+                break;
+            case OP_FALSE:
+                result = 0;
+                break;
+            case OP_NOT:
+                result = !result;
+                break;
+            case OP_JUMP_FALSE:
+                if (!result)
+                    pc = (size_t)op->value - 1;
+                break;
+            case OP_JUMP_TRUE:
+                if (result)
+                    pc = (size_t)op->value - 1;
+                break;
+            case OP_NAME:
+                result = fnmatch(op->pattern, entry->name, 0) == 0;
+                break;
+            case OP_INAME:
+                result = fnmatch(op->pattern, entry->name, FNM_CASEFOLD) == 0;
+                break;
+            case OP_PATH:
+                result = fnmatch(op->pattern, entry->path, 0) == 0;
+                break;
+            case OP_REGEX:
+                result = regexec(op->regex, entry->path, 0, NULL, 0) == 0;
+                break;
+            case OP_TYPE:
+                result = entry->flag == op->value;
+                break;
+            case OP_SIZE:
+                stats = entry_stats(pred, entry, &local, &fetched, counters);
+                result = stats && compare(((long long)stats->stx_size + op->unit - 1) / op->unit, op->cmp, op->value);
+                break;
+            case OP_MTIME:
+                stats = entry_stats(pred, entry, &local, &fetched, counters);
+                result = stats && compare(((long long)pred->now - stats->stx_mtime.tv_sec) / op->unit, op->cmp, op->value);
+                break;
+            case OP_PRUNE:
+                result = 1;
+                prune = PRED_PRUNE;
+                break;
+        }
+    }
+    return (result ? PRED_MATCH : 0) | prune;
+}
+
+int predicate_needs_path(const Predicate *pred) {
+    return pred->needs_path;
+}
+
+unsigned int predicate_stat_mask(const Predicate *pred) {
+    return pred->stat_mask;
+}
+
+void predicate_free(Predicate *pred) {
+    if (!pred) {
+        return;
+    }
+    for (size_t i = 0; i < pred->count; i++) {
+        free(pred->ops[i].pattern);
+        if (pred->ops[i].regex) {
+            regfree(pred->ops[i].regex);
+            free(pred->ops[i].regex);
+        }
+    }
+    free(pred->ops);
+    free(pred);
+}
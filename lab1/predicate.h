@@ -0,0 +1,44 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "classify.h"
+
+#define PRED_MATCH 1
+#define PRED_PRUNE 2
+
+/* find-like expression compiled once into a short jump program:
+ *   -name GLOB  -iname GLOB  -path GLOB  -regex ERE  -type l|f|d
+ *   -size [+-]N[ckMG]  -mtime [+-]DAYS  -mmin [+-]MINUTES
+ *   -mindepth N  -maxdepth N  -prune  -true  -false
+ *   ! -not  -a -and  -o -or  ( )
+ * Adjacent primaries are and-ed. Name tests only look at the readdir name,
+ * so they decide before any stat; -size and -mtime stat lazily, and only
+ * when evaluation actually reaches them. */
+typedef struct Predicate Predicate;
+
+typedef struct PredicateEntry {
+    const char *name;
+    const char *path;
+    size_t depth;
+    int flag;
+    int dir_fd;
+    int follow;
+    const struct statx *stats;
+} PredicateEntry;
+
+/* Prints the problem and returns NULL if argv is not a valid expression. */
+Predicate *predicate_compile(int argc, char *const argv[]);
+/* Returns PRED_MATCH if entry satisfies the expression, plus PRED_PRUNE
+ * when entry is a directory that must not be descended into (-prune, or
+ * -maxdepth reached). stats may be NULL; it is only used if it holds the
+ * fields the program needs. */
+int predicate_eval(const Predicate *pred, const PredicateEntry *entry, WalkCounters *counters);
+/* Whether entry->path must be filled in (-path, -regex). */
+int predicate_needs_path(const Predicate *pred);
+/* statx mask that covers every stat-based test, 0 if there are none. */
+unsigned int predicate_stat_mask(const Predicate *pred);
+void predicate_free(Predicate *pred);
+
+#endif
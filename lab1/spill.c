@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spill.h"
+#include "entry_sort.h"
+#include "output.h"
+
+#define RUN_BUFFER_SIZE (256 * 1024)
+/* Most runs merged at once; more are first merged into longer runs so the
+ * open files and their buffers stay bounded. */
+#define MAX_MERGE_RUNS 64
+
+/* One record per entry: flag digit, collation key, NUL, path, NUL.
+ * Keys never contain NUL, strxfrm() output is a string. */
+typedef struct RunReader {
+    FILE *file;
+    char *key;
+    size_t key_capacity;
+    char *path;
+    size_t path_capacity;
+    int flag;
+} RunReader;
+
+static void run_path(const SpillSort *spill, int run, char *buf, size_t size) {
+    snprintf(buf, size, "%s/run%06d", spill->dir, run);
+}
+
+void spill_init(SpillSort *spill, size_t budget, const char *tmp_dir) {
+    spill->budget = budget;
+    spill->run_count = 0;
+    spill->keyed = 1;
+    snprintf(spill->dir, sizeof(spill->dir), "%s/dirwalk.XXXXXX", tmp_dir);
+    if (!mkdtemp(spill->dir)) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static FILE *create_run(SpillSort *spill) {
+    char path[PATH_MAX + 16];
+    run_path(spill, spill->run_count++, path, sizeof(path));
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(file, NULL, _IOFBF, RUN_BUFFER_SIZE);
+    return file;
+}
+
+static void close_run(FILE *file) {
+    if (fclose(file) != 0) {
+        perror("fclose");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void write_run(SpillSort *spill, ArrayEntries *array) {
+    const char **keys = (const char**)malloc(sizeof(char*) * (array->size ? array->size : 1));
+    if (!keys) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    StringArena key_arena = {NULL, 0};
+    if (!sort_entries_keyed(array, 1, keys, &key_arena)) {
+        spill->keyed = 0;
+    }
+
+    FILE *file = create_run(spill);
+    PathBuffer entry = {NULL, 0, 0};
+    for (size_t i = 0; i < array->size; i++) {
+        const char *full_path = entry_path(array, i, &entry);
+        fputc('0' + array->entries[i].flag, file);
+        fputs(keys[i] ? keys[i] : full_path, file);
+        fputc('\0', file);
+        fputs(full_path, file);
+        fputc('\0', file);
+    }
+    path_free(&entry);
+    close_run(file);
+    arena_free(&key_arena);
+    free(keys);
+    clear_entries(array);
+}
+
+void spill_check(SpillSort *spill, ArrayEntries *array) {
+    if (entries_bytes(array) > spill->budget) {
+        write_run(spill, array);
+    }
+}
+
+static int read_record(RunReader *reader) {
+    if (getdelim(&reader->key, &reader->key_capacity, '\0', reader->file) <= 0) {
+        return 0;
+    }
+    if (getdelim(&reader->path, &reader->path_capacity, '\0', reader->file) <= 0) {
+        fprintf(stderr, "dirwalk: truncated sort run\n");
+        exit(EXIT_FAILURE);
+    }
+    reader->flag = reader->key[0] - '0';
+    return 1;
+}
+
+static int run_less(const SpillSort *spill, const RunReader *a, const RunReader *b) {
+    if (spill->keyed) {
+        return strcmp(a->key + 1, b->key + 1) < 0;
+    }
+    return strcoll(a->path, b->path) < 0;
+}
+
+static void sift_down(const SpillSort *spill, RunReader **heap, int size, int i) {
+    for (;;) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && run_less(spill, heap[left], heap[smallest]))
+            smallest = left;
+        if (right < size && run_less(spill, heap[right], heap[smallest]))
+            smallest = right;
+        if (smallest == i)
+            return;
+        RunReader *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/* Merges runs first .. first + count - 1 and deletes them. The merged
+ * records go to run if it is not NULL, otherwise the entries go to out. */
+static void merge_runs(const SpillSort *spill, int first, int count, FILE *run, OutputBuffer *out) {
+    RunReader *readers = (RunReader*)calloc(count, sizeof(RunReader));
+    RunReader **heap = (RunReader**)malloc(sizeof(RunReader*) * count);
+    if (!readers || !heap) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int heap_size = 0;
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX + 16];
+        run_path(spill, first + i, path, sizeof(path));
+        readers[i].file = fopen(path, "r");
+        if (!readers[i].file) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        setvbuf(readers[i].file, NULL, _IOFBF, RUN_BUFFER_SIZE);
+        unlink(path);
+        if (read_record(&readers[i])) {
+            heap[heap_size++] = &readers[i];
+        }
+    }
+    for (int i = heap_size / 2 - 1; i >= 0; i--) {
+        sift_down(spill, heap, heap_size, i);
+    }
+    while (heap_size > 0) {
+        RunReader *top = heap[0];
+        if (run) {
+            fputs(top->key, run);
+            fputc('\0', run);
+            fputs(top->path, run);
+            fputc('\0', run);
+        } else {
+            output_entry(out, top->flag, top->path);
+        }
+        if (!read_record(top)) {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(spill, heap, heap_size, 0);
+    }
+
+    for (int i = 0; i < count; i++) {
+        fclose(readers[i].file);
+        free(readers[i].key);
+        free(readers[i].path);
+    }
+    free(readers);
+    free(heap);
+}
+
+int spill_finish(SpillSort *spill, ArrayEntries *array, OutputBuffer *out) {
+    if (spill->run_count == 0) {
+        rmdir(spill->dir);
+        return 0;
+    }
+    if (array->size > 0) {
+        write_run(spill, array);
+    }
+
+    int first = 0;
+    while (spill->run_count - first > MAX_MERGE_RUNS) {
+        FILE *run = create_run(spill);
+        merge_runs(spill, first, MAX_MERGE_RUNS, run, NULL);
+        close_run(run);
+        first += MAX_MERGE_RUNS;
+    }
+    merge_runs(spill, first, spill->run_count - first, NULL, out);
+    rmdir(spill->dir);
+    return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdio.h>
+#include <limits.h>
+#include <stddef.h>
+#include "array_entries.h"
+
+struct OutputBuffer;
+
+/* External merge sort for -s: whenever the collected entries exceed budget
+ * bytes they are sorted and written to a run file under a private temp
+ * directory. spill_finish() then k-way merges the runs into the output,
+ * first combining them into longer runs when there are too many to open
+ * at once. */
+typedef struct SpillSort {
+    size_t budget;
+    char dir[PATH_MAX];
+    int run_count;
+    int keyed;
+} SpillSort;
+
+void spill_init(SpillSort *spill, size_t budget, const char *tmp_dir);
+/* Writes array out as a sorted run if it has grown past the budget. */
+void spill_check(SpillSort *spill, ArrayEntries *array);
+/* Returns 0 if nothing was spilled (array is left for the in-memory sort),
+ * otherwise spills the rest of array and merges every run into out. */
+int spill_finish(SpillSort *spill, ArrayEntries *array, struct OutputBuffer *out);
+
+#endif
@@ -0,0 +1,87 @@
+#!/bin/sh
+# Checks --diff on a generated source tree and a mirror with known
+# changes: the exact lines with one thread, the same lines in any order
+# with -j 4, the -f filter, the exit status, no output and status 0 for
+# a hard-linked copy and for a tree against itself, and status 2 when a
+# root is missing.
+# Usage: ./test_diff.sh
+
+DIRWALK=${DIRWALK:-./dirwalk}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/test_diff.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+export LC_ALL=C
+
+A=$WORK/a
+B=$WORK/b
+for d in same same/deep/er gone kept kept/sub; do
+    mkdir -p "$A/$d"
+done
+for i in $(seq 1 50); do
+    echo "$i" > "$A/same/f$i"
+    echo "$i" > "$A/same/deep/er/f$i"
+done
+echo short > "$A/grows"
+echo data > "$A/kept/sub/file"
+: > "$A/gone/inside"
+: > "$A/becomes_dir"
+ln -s target "$A/link"
+cp -a "$A" "$B"
+echo longer >> "$B/grows"
+rm -r "$B/gone"
+rm "$B/becomes_dir"
+mkdir "$B/becomes_dir"
+ln -sf longer_target "$B/link"
+: > "$B/kept/sub/new"
+mkdir "$B/added_dir"
+: > "$B/added_dir/inside"
+
+failed=0
+check() {
+    if cmp -s "$WORK/expected" "$WORK/actual"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        diff "$WORK/expected" "$WORK/actual" | head -5
+        failed=1
+    fi
+}
+
+cat > "$WORK/expected" <<EOF
+Added: added_dir
+Type changed: becomes_dir
+Removed: gone
+Size changed: grows
+Size changed: link
+Added: kept/sub/new
+EOF
+$DIRWALK --diff "$A" "$B" > "$WORK/actual"
+check "--diff"
+$DIRWALK --diff "$A" "$B" > /dev/null
+echo "exit $?" > "$WORK/actual"
+echo "exit 1" > "$WORK/expected"
+check "--diff exit status"
+
+$DIRWALK --diff "$A" "$B" | sort > "$WORK/expected"
+$DIRWALK -j 4 --diff "$A" "$B" | sort > "$WORK/actual"
+check "-j 4 --diff"
+
+printf 'Type changed: becomes_dir\nSize changed: grows\nAdded: kept/sub/new\n' > "$WORK/expected"
+$DIRWALK -f --diff "$A" "$B" > "$WORK/actual"
+check "-f --diff"
+
+cp -al "$A" "$WORK/linked"
+echo "exit 0" > "$WORK/expected"
+for other in "$WORK/linked" "$A"; do
+    $DIRWALK --diff "$A" "$other" > "$WORK/actual"
+    echo "exit $?" >> "$WORK/actual"
+    check "--diff against $(basename "$other")"
+done
+
+echo "exit 2" > "$WORK/expected"
+$DIRWALK --diff "$A" "$WORK/missing" > /dev/null 2>&1
+echo "exit $?" > "$WORK/actual"
+check "--diff with a missing second root"
+$DIRWALK --diff "$WORK/missing" "$A" > /dev/null 2>&1
+echo "exit $?" > "$WORK/actual"
+check "--diff with a missing first root"
+exit $failed
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Checks that the ordered -s traversal prints exactly what collecting every
+# entry and sorting with compare_for_sorting() prints (the -s -I path still
+# does that), and that both match sort(1) on the unsorted paths. Runs on a
+# generated tree of names around '/' in byte order, and on any directories
+# given as arguments. Also checks that -L -j expands the same alias of a
+# directory reachable through several symlinks as the sequential -L walk.
+# Usage: ./test_sorted.sh [directory...]
+
+DIRWALK=${DIRWALK:-./dirwalk}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/test_sorted.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+export LC_ALL=C
+
+# Siblings that sort differently as names than as path prefixes: ' ', '!',
+# '-' and '.' come before '/', '0' and letters after it.
+TREE=$WORK/tree
+for d in a a/b a/b/c a-b a.b a.b/c "a b" a0 ab ab/a empty deep; do
+    mkdir -p "$TREE/$d"
+done
+for f in a/x a/b/y a/b/c/.z a-b/f a.b/c/g "a b/h" a0/i 'a!' 'a~' ab/a/j Z "$(printf 'caf\303\251')"; do
+    : > "$TREE/$f"
+done
+path=$TREE/deep
+for i in $(seq 1 40); do
+    path=$path/d$i
+    mkdir -p "$path"
+    : > "$path/f"
+    : > "$path.f"
+done
+ln -s a "$TREE/link"
+ln -s missing "$TREE/dangling"
+
+failed=0
+check() {
+    name=$1
+    shift
+    if cmp -s "$WORK/expected" "$WORK/actual"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        diff "$WORK/expected" "$WORK/actual" | head -5
+        failed=1
+    fi
+}
+
+for dir in "$TREE" "$@"; do
+    for flags in "" "-f" "-d" "-l"; do
+        rm -f "$WORK/index"
+        $DIRWALK -s -I "$WORK/index" $flags "$dir" > "$WORK/expected" 2>/dev/null
+        for walk in "" "-j 4"; do
+            $DIRWALK -s $walk $flags "$dir" > "$WORK/actual" 2>/dev/null
+            check "$dir -s $walk $flags"
+        done
+        $DIRWALK $flags "$dir" 2>/dev/null | sed 's/^[A-Za-z]*: //' | sort > "$WORK/expected"
+        $DIRWALK -s $flags "$dir" 2>/dev/null | sed 's/^[A-Za-z]*: //' > "$WORK/actual"
+        check "$dir -s $flags against sort(1)"
+    done
+done
+# Forty directories that all link to one shared directory and on to each
+# other, so the -j workers reach most aliases in a different order than
+# the sequential walk.
+ALIASES=$WORK/aliases
+mkdir -p "$ALIASES/shared/x" "$ALIASES/shared/y"
+: > "$ALIASES/shared/x/f"
+ln -s .. "$ALIASES/shared/up"
+for i in $(seq 1 40); do
+    mkdir -p "$ALIASES/d$i/sub"
+    : > "$ALIASES/d$i/f"
+    ln -s ../shared "$ALIASES/d$i/s"
+    ln -s "../../d$((i % 40 + 1))" "$ALIASES/d$i/sub/next"
+done
+for flags in "-L" "-s -L"; do
+    $DIRWALK $flags "$ALIASES" > "$WORK/expected" 2>/dev/null
+    for run in 1 2 3; do
+        $DIRWALK $flags -j 4 "$ALIASES" > "$WORK/actual" 2>/dev/null
+        check "$ALIASES $flags -j 4 (run $run)"
+    done
+done
+exit $failed
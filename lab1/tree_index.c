@@ -0,0 +1,608 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tree_index.h"
+#include "path_buffer.h"
+
+#define INDEX_MAGIC "DWINDEX1"
+#define NO_DIR UINT32_MAX
+
+/* Snapshot layout: header, root path padded to 8 bytes, IndexDir[dir_count],
+ * IndexChild[child_count], then the NUL-terminated names. Directory 0 is
+ * the root; each directory's children are contiguous and in readdir order. */
+typedef struct IndexHeader {
+    char magic[8];
+    int64_t scan_sec;
+    int64_t scan_nsec;
+    uint64_t dir_count;
+    uint64_t child_count;
+    uint64_t names_size;
+    uint64_t root_len;
+} IndexHeader;
+
+typedef struct IndexDir {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t first_child;
+    uint64_t child_count;
+} IndexDir;
+
+typedef struct IndexChild {
+    uint64_t name;
+    uint32_t dir;
+    int32_t flag;
+} IndexChild;
+
+typedef struct OldIndex {
+    void *map;
+    size_t size;
+    int64_t scan_sec;
+    const IndexDir *dirs;
+    const IndexChild *children;
+    const char *names;
+    uint64_t dir_count;
+} OldIndex;
+
+typedef struct ChildList {
+    IndexChild *items;
+    size_t size;
+    size_t capacity;
+} ChildList;
+
+typedef struct FreshIndex {
+    IndexDir *dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    IndexChild *children;
+    size_t child_count;
+    size_t child_capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    ChildList *pending;
+    size_t pending_count;
+} FreshIndex;
+
+/* Name -> child position for one old directory that has to be re-read. */
+typedef struct ChildLookup {
+    uint64_t *slots;
+    size_t mask;
+} ChildLookup;
+
+/* An entry of a re-read directory waiting to be visited; name is an
+ * offset into IndexWalk.names. */
+typedef struct IndexItem {
+    size_t name;
+    int flag;
+    uint32_t old_dir;
+} IndexItem;
+
+/* A directory on the explicit stack. A replayed one walks the old
+ * snapshot's children with next; a re-read one reads a batch at a time
+ * into walk->items[item_base, ...) and visits them with next. dirs_left
+ * counts subdirectories not opened yet among what has been read. */
+typedef struct IndexFrame {
+    int replay;
+    int open;
+    int exhausted;
+    int fd;
+    DirReader reader;
+    const IndexDir *old;
+    ChildLookup lookup;
+    uint32_t index;
+    size_t depth;
+    size_t path_len;
+    uint64_t next;
+    size_t item_base;
+    size_t names_base;
+    size_t dirs_left;
+} IndexFrame;
+
+typedef struct IndexWalk {
+    const WalkOptions *options;
+    EntrySink *sink;
+    WalkCounters *counters;
+    IndexStats *stats;
+    DirBufferPool buffers;
+    EntryBatch batch;
+    StatRing *ring;
+    OldIndex old;
+    FreshIndex fresh;
+    PathBuffer path;
+    IndexFrame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    IndexItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    size_t open_readers;
+} IndexWalk;
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static size_t padded(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static int load_index(OldIndex *old, const char *index_path, const char *root) {
+    memset(old, 0, sizeof(*old));
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    const IndexHeader *header = (const IndexHeader*)map;
+    const char *base = (const char*)map;
+    size_t root_size = padded(header->root_len);
+    size_t dirs_offset = sizeof(IndexHeader) + root_size;
+    size_t children_offset = dirs_offset + header->dir_count * sizeof(IndexDir);
+    size_t names_offset = children_offset + header->child_count * sizeof(IndexChild);
+    int valid = memcmp(header->magic, INDEX_MAGIC, 8) == 0 &&
+                header->root_len == strlen(root) && header->dir_count > 0 &&
+                header->dir_count < NO_DIR && header->child_count < SIZE_MAX / sizeof(IndexChild) &&
+                names_offset + header->names_size == (size_t)st.st_size &&
+                memcmp(base + sizeof(IndexHeader), root, header->root_len) == 0 &&
+                (header->names_size == 0 || base[st.st_size - 1] == '\0');
+    const IndexDir *dirs = (const IndexDir*)(base + dirs_offset);
+    const IndexChild *children = (const IndexChild*)(base + children_offset);
+    for (uint64_t i = 0; valid && i < header->dir_count; i++) {
+        valid = dirs[i].first_child <= header->child_count &&
+                dirs[i].child_count <= header->child_count - dirs[i].first_child;
+    }
+    for (uint64_t i = 0; valid && i < header->child_count; i++) {
+        valid = children[i].name < header->names_size &&
+                (children[i].dir == NO_DIR || children[i].dir < header->dir_count);
+    }
+    if (!valid) {
+        fprintf(stderr, "Ignoring index %s: not a snapshot of %s\n", index_path, root);
+        munmap(map, st.st_size);
+        return 0;
+    }
+    old->map = map;
+    old->size = st.st_size;
+    old->scan_sec = header->scan_sec;
+    old->dirs = dirs;
+    old->children = children;
+    old->names = base + names_offset;
+    old->dir_count = header->dir_count;
+    return 1;
+}
+
+/* A directory changed within a second of the old scan could have been
+ * modified again without its timestamps moving, so only older ones count. */
+static int unchanged(const OldIndex *old, const IndexDir *dir, const struct stat *st) {
+    return dir->ino == st->st_ino && dir->dev == st->st_dev &&
+           dir->mtime_sec == st->st_mtim.tv_sec && dir->mtime_nsec == st->st_mtim.tv_nsec &&
+           dir->ctime_sec == st->st_ctim.tv_sec && dir->ctime_nsec == st->st_ctim.tv_nsec &&
+           dir->mtime_sec + 1 < old->scan_sec && dir->ctime_sec + 1 < old->scan_sec;
+}
+
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void build_lookup(ChildLookup *lookup, const OldIndex *old, const IndexDir *dir) {
+    size_t size = 16;
+    while (size < dir->child_count * 2) {
+        size *= 2;
+    }
+    lookup->mask = size - 1;
+    lookup->slots = (uint64_t*)calloc(size, sizeof(uint64_t));
+    if (!lookup->slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t k = 0; k < dir->child_count; k++) {
+        size_t slot = hash_name(old->names + old->children[dir->first_child + k].name) & lookup->mask;
+        while (lookup->slots[slot]) {
+            slot = (slot + 1) & lookup->mask;
+        }
+        lookup->slots[slot] = dir->first_child + k + 1;
+    }
+}
+
+static uint32_t find_old_dir(const OldIndex *old, const ChildLookup *lookup, const char *name) {
+    size_t slot = hash_name(name) & lookup->mask;
+    while (lookup->slots[slot]) {
+        const IndexChild *child = &old->children[lookup->slots[slot] - 1];
+        if (strcmp(old->names + child->name, name) == 0) {
+            return child->dir;
+        }
+        slot = (slot + 1) & lookup->mask;
+    }
+    return NO_DIR;
+}
+
+static uint32_t fresh_dir(FreshIndex *fresh, const struct stat *st) {
+    if (fresh->dir_count == fresh->dir_capacity) {
+        fresh->dir_capacity = fresh->dir_capacity ? fresh->dir_capacity * 2 : 1024;
+        fresh->dirs = (IndexDir*)xrealloc(fresh->dirs, fresh->dir_capacity * sizeof(IndexDir));
+    }
+    IndexDir *dir = &fresh->dirs[fresh->dir_count];
+    dir->mtime_sec = st->st_mtim.tv_sec;
+    dir->mtime_nsec = st->st_mtim.tv_nsec;
+    dir->ctime_sec = st->st_ctim.tv_sec;
+    dir->ctime_nsec = st->st_ctim.tv_nsec;
+    dir->dev = st->st_dev;
+    dir->ino = st->st_ino;
+    dir->first_child = 0;
+    dir->child_count = 0;
+    return (uint32_t)fresh->dir_count++;
+}
+
+static uint64_t fresh_name(FreshIndex *fresh, const char *name) {
+    size_t len = strlen(name) + 1;
+    if (fresh->names_size + len > fresh->names_capacity) {
+        fresh->names_capacity = fresh->names_capacity ? fresh->names_capacity * 2 : 65536;
+        while (fresh->names_size + len > fresh->names_capacity) {
+            fresh->names_capacity *= 2;
+        }
+        fresh->names = (char*)xrealloc(fresh->names, fresh->names_capacity);
+    }
+    memcpy(fresh->names + fresh->names_size, name, len);
+    fresh->names_size += len;
+    return fresh->names_size - len;
+}
+
+/* Children are staged per depth and copied out when their directory is
+ * finished, which keeps every directory's children contiguous. */
+static ChildList *pending_at(FreshIndex *fresh, size_t depth) {
+    if (depth >= fresh->pending_count) {
+        size_t count = fresh->pending_count ? fresh->pending_count * 2 : 8;
+        while (count <= depth) {
+            count *= 2;
+        }
+        fresh->pending = (ChildList*)xrealloc(fresh->pending, count * sizeof(ChildList));
+        memset(fresh->pending + fresh->pending_count, 0, (count - fresh->pending_count) * sizeof(ChildList));
+        fresh->pending_count = count;
+    }
+    return &fresh->pending[depth];
+}
+
+static void push_child(FreshIndex *fresh, size_t depth, uint64_t name, int flag, uint32_t dir) {
+    ChildList *list = pending_at(fresh, depth);
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = (IndexChild*)xrealloc(list->items, list->capacity * sizeof(IndexChild));
+    }
+    IndexChild *child = &list->items[list->size++];
+    child->name = name;
+    child->dir = dir;
+    child->flag = flag;
+}
+
+static void finish_dir(FreshIndex *fresh, uint32_t index, size_t depth) {
+    ChildList *list = pending_at(fresh, depth);
+    if (fresh->child_count + list->size > fresh->child_capacity) {
+        fresh->child_capacity = fresh->child_capacity ? fresh->child_capacity * 2 : 4096;
+        while (fresh->child_count + list->size > fresh->child_capacity) {
+            fresh->child_capacity *= 2;
+        }
+        fresh->children = (IndexChild*)xrealloc(fresh->children, fresh->child_capacity * sizeof(IndexChild));
+    }
+    if (list->size) {
+        memcpy(fresh->children + fresh->child_count, list->items, list->size * sizeof(IndexChild));
+    }
+    fresh->dirs[index].first_child = fresh->child_count;
+    fresh->dirs[index].child_count = list->size;
+    fresh->child_count += list->size;
+    list->size = 0;
+}
+
+static void *grow(void *ptr, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return ptr;
+    }
+    size_t count = *capacity ? *capacity : 64;
+    while (count < needed) {
+        count *= 2;
+    }
+    *capacity = count;
+    return xrealloc(ptr, count * item_size);
+}
+
+static size_t push_name(IndexWalk *walk, const char *name) {
+    size_t offset = walk->names_size;
+    size_t len = strlen(name) + 1;
+    walk->names = (char*)grow(walk->names, &walk->names_capacity, offset + len, 1);
+    memcpy(walk->names + offset, name, len);
+    walk->names_size += len;
+    return offset;
+}
+
+/* The fd children are opened relative to: the reader's for a re-read
+ * directory, the O_PATH fd for a replayed one. */
+static int frame_fd(const IndexFrame *frame) {
+    return frame->replay ? frame->fd : dir_reader_fd(&frame->reader);
+}
+
+/* Closes the frame's fd once no subdirectory is left to open through it,
+ * so a long chain of single-child directories keeps O(1) fds open. */
+static void close_frame(IndexWalk *walk, IndexFrame *frame) {
+    if (!frame->open)
+        return;
+    if (frame->replay) {
+        close(frame->fd);
+    } else {
+        dir_reader_close(&frame->reader);
+        walk->open_readers--;
+    }
+    frame->open = 0;
+}
+
+/* Takes ownership of path_fd, an O_PATH fd of a directory whose path is in
+ * walk->path, and pushes its frame: replaying the old snapshot's children
+ * when the directory is unchanged, reading it otherwise. Returns its index
+ * in the fresh snapshot, NO_DIR when it could not be stat'ed. */
+static uint32_t push_frame(IndexWalk *walk, int path_fd, size_t depth, uint32_t old_index) {
+    const WalkOptions *options = walk->options;
+    struct stat st;
+    if (fstat(path_fd, &st) == -1) {
+        perror("fstat");
+        close(path_fd);
+        return NO_DIR;
+    }
+    uint32_t index = fresh_dir(&walk->fresh, &st);
+    walk->stats->dirs++;
+    walk->frames = (IndexFrame*)grow(walk->frames, &walk->frame_capacity, walk->frame_count + 1, sizeof(IndexFrame));
+    IndexFrame *frame = &walk->frames[walk->frame_count++];
+    memset(frame, 0, sizeof(*frame));
+    frame->index = index;
+    frame->depth = depth;
+    frame->path_len = walk->path.len;
+    frame->item_base = walk->item_count;
+    frame->names_base = walk->names_size;
+    frame->old = (old_index != NO_DIR) ? &walk->old.dirs[old_index] : NULL;
+    frame->open = 1;
+    if (frame->old && unchanged(&walk->old, frame->old, &st)) {
+        walk->stats->reused++;
+        walk->stats->replayed += frame->old->child_count;
+        frame->replay = 1;
+        frame->fd = path_fd;
+        frame->exhausted = 1;
+        for (uint64_t k = 0; k < frame->old->child_count; k++) {
+            frame->dirs_left += walk->old.children[frame->old->first_child + k].flag == 2;
+        }
+        if (frame->dirs_left == 0) {
+            close_frame(walk, frame);
+        }
+        return index;
+    }
+    walk->stats->reread++;
+    frame->next = frame->item_base;
+    int fd = openat(path_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(path_fd);
+    char *buffer = (options->reader == READER_GETDENTS) ? dir_buffer_get(&walk->buffers, walk->open_readers) : NULL;
+    if (fd == -1) {
+        perror("opendir");
+        frame->open = 0;
+    } else if (dir_reader_open(&frame->reader, fd, options->reader, buffer, options->buffer_size) == -1) {
+        frame->open = 0;
+    } else {
+        walk->open_readers++;
+    }
+    if (!frame->open) {
+        frame->exhausted = 1;
+        frame->old = NULL;
+    } else if (frame->old) {
+        build_lookup(&frame->lookup, &walk->old, frame->old);
+    }
+    return index;
+}
+
+/* Records one child of the top frame's directory: streams it, and for a
+ * subdirectory opens it with O_PATH and pushes its frame. */
+static void visit_child(IndexWalk *walk, const char *name, int flag, uint32_t old_index) {
+    IndexFrame *frame = &walk->frames[walk->frame_count - 1];
+    size_t depth = frame->depth;
+    uint64_t name_offset = fresh_name(&walk->fresh, name);
+    uint32_t sub = NO_DIR;
+    int emit = should_emit(walk->options, flag);
+    if (emit || flag == 2) {
+        PathBuffer *path = &walk->path;
+        path_truncate(path, frame->path_len);
+        path_push(path, name);
+        if (emit) {
+            sink_entry(walk->sink, path->data, flag, NULL);
+        }
+        if (flag == 2) {
+            int fd = openat(frame_fd(frame), name, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            frame->dirs_left--;
+            if (frame->exhausted && frame->dirs_left == 0) {
+                close_frame(walk, frame);
+            }
+            if (fd == -1) {
+                perror("opendir");
+            } else {
+                sub = push_frame(walk, fd, depth + 1, old_index);
+            }
+        }
+    }
+    push_child(&walk->fresh, depth, name_offset, flag, sub);
+}
+
+/* Reads the next batch of a re-read directory into walk->items above the
+ * frame's item_base. Returns 0 at the end of the directory. */
+static int read_batch(IndexWalk *walk, IndexFrame *frame) {
+    const WalkOptions *options = walk->options;
+    walk->item_count = frame->item_base;
+    walk->names_size = frame->names_base;
+    if (frame->exhausted) {
+        return 0;
+    }
+    EntryBatch *batch = &walk->batch;
+    size_t count = batch_fill(batch, &frame->reader);
+    frame->exhausted = count < batch->capacity;
+    if (count > 0) {
+        batch_classify(batch, dir_reader_fd(&frame->reader), options->stat_mask, &walk->ring, walk->counters);
+    }
+    for (size_t i = 0; i < count; i++) {
+        int flag = batch->flags[i];
+        if (flag == -1)
+            continue;
+        const char *name = batch_name(batch, i);
+        walk->items = (IndexItem*)grow(walk->items, &walk->item_capacity, walk->item_count + 1, sizeof(IndexItem));
+        IndexItem *item = &walk->items[walk->item_count++];
+        item->name = push_name(walk, name);
+        item->flag = flag;
+        item->old_dir = (frame->old && flag == 2) ? find_old_dir(&walk->old, &frame->lookup, name) : NO_DIR;
+        if (flag == 2) {
+            frame->dirs_left++;
+        }
+    }
+    frame->next = frame->item_base;
+    if (frame->exhausted && frame->dirs_left == 0) {
+        close_frame(walk, frame);
+    }
+    return count > 0;
+}
+
+/* Visits the top frame's next child; pops the frame once it has none. */
+static void step(IndexWalk *walk) {
+    IndexFrame *frame = &walk->frames[walk->frame_count - 1];
+    if (frame->replay) {
+        const IndexDir *old = frame->old;
+        if (frame->next < old->child_count) {
+            const IndexChild *child = &walk->old.children[old->first_child + frame->next++];
+            visit_child(walk, walk->old.names + child->name, child->flag, child->dir);
+            return;
+        }
+    } else if (frame->next < walk->item_count || read_batch(walk, frame)) {
+        if (frame->next < walk->item_count) {
+            IndexItem item = walk->items[frame->next++];
+            visit_child(walk, walk->names + item.name, item.flag, item.old_dir);
+        }
+        return;
+    }
+    close_frame(walk, frame);
+    free(frame->lookup.slots);
+    finish_dir(&walk->fresh, frame->index, frame->depth);
+    walk->item_count = frame->item_base;
+    walk->names_size = frame->names_base;
+    walk->frame_count--;
+    if (walk->sink->out) {
+        output_tick(walk->sink->out);
+    }
+}
+
+static void write_all(FILE *file, const void *data, size_t size) {
+    if (size && fwrite(data, 1, size, file) != size) {
+        perror("fwrite");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void save_index(const FreshIndex *fresh, const char *index_path, const char *root, const struct timespec *scan_start) {
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        perror("fopen");
+        return;
+    }
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.scan_sec = scan_start->tv_sec;
+    header.scan_nsec = scan_start->tv_nsec;
+    header.dir_count = fresh->dir_count;
+    header.child_count = fresh->child_count;
+    header.names_size = fresh->names_size;
+    header.root_len = strlen(root);
+    char padding[8] = {0};
+    write_all(file, &header, sizeof(header));
+    write_all(file, root, header.root_len);
+    write_all(file, padding, padded(header.root_len) - header.root_len);
+    write_all(file, fresh->dirs, fresh->dir_count * sizeof(IndexDir));
+    write_all(file, fresh->children, fresh->child_count * sizeof(IndexChild));
+    write_all(file, fresh->names, fresh->names_size);
+    if (fclose(file) != 0 || rename(tmp_path, index_path) == -1) {
+        perror("index");
+        unlink(tmp_path);
+    }
+}
+
+void indexed_dirwalk(const char *dir_path, const char *index_path, const WalkOptions *options,
+                     EntrySink *sink, WalkCounters *counters, IndexStats *stats) {
+    IndexWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.options = options;
+    walk.sink = sink;
+    walk.counters = counters;
+    walk.stats = stats;
+    walk.buffers.size = options->buffer_size;
+    if (options->use_uring) {
+        walk.ring = stat_ring_create(STAT_RING_ENTRIES);
+    }
+    int have_old = load_index(&walk.old, index_path, dir_path);
+
+    struct timespec scan_start, start, end;
+    clock_gettime(CLOCK_REALTIME, &scan_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    walk.batch.inode_order = options->inode_order;
+    path_set(&walk.path, dir_path);
+    int fd = open(dir_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("opendir");
+    } else if (push_frame(&walk, fd, 0, have_old ? 0 : NO_DIR) != NO_DIR) {
+        while (walk.frame_count > 0) {
+            step(&walk);
+        }
+        save_index(&walk.fresh, index_path, dir_path, &scan_start);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (have_old) {
+        munmap(walk.old.map, walk.old.size);
+    }
+    for (size_t i = 0; i < walk.fresh.pending_count; i++) {
+        free(walk.fresh.pending[i].items);
+    }
+    free(walk.fresh.pending);
+    free(walk.fresh.dirs);
+    free(walk.fresh.children);
+    free(walk.fresh.names);
+    dir_buffer_free(&walk.buffers);
+    batch_free(&walk.batch);
+    path_free(&walk.path);
+    free(walk.frames);
+    free(walk.items);
+    free(walk.names);
+    stat_ring_destroy(walk.ring);
+}
@@ -0,0 +1,23 @@
+#ifndef TREE_INDEX_H
+#define TREE_INDEX_H
+
+#include "walk_options.h"
+#include "classify.h"
+#include "output.h"
+
+typedef struct IndexStats {
+    unsigned long dirs;
+    unsigned long reread;
+    unsigned long reused;
+    unsigned long replayed;
+    double seconds;
+} IndexStats;
+
+/* Sequential walk backed by an on-disk snapshot at index_path. Directories
+ * whose inode, mtime and ctime match the snapshot replay their cached
+ * children instead of being read again; everything else is read as usual.
+ * A fresh snapshot replaces the old one when the walk is done. */
+void indexed_dirwalk(const char *dir_path, const char *index_path, const WalkOptions *options,
+                     EntrySink *sink, WalkCounters *counters, IndexStats *stats);
+
+#endif
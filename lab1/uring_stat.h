@@ -0,0 +1,19 @@
+#ifndef URING_STAT_H
+#define URING_STAT_H
+
+#include <stddef.h>
+
+struct statx;
+
+typedef struct StatRing StatRing;
+
+/* Returns NULL when io_uring is unavailable (old kernel, seccomp, sysctl). */
+StatRing *stat_ring_create(unsigned int entries);
+/* statx(dir_fd, names[i], AT_SYMLINK_NOFOLLOW, mask, stats[i]) for every i,
+ * submitted as one batch and reaped in completion order. results[i] gets
+ * 0 or -errno. Returns -1 if the ring itself failed. */
+int stat_ring_statx(StatRing *ring, int dir_fd, const char *const *names, size_t count,
+                    unsigned int mask, struct statx *const *stats, int *results);
+void stat_ring_destroy(StatRing *ring);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef WALK_OPTIONS_H
+#define WALK_OPTIONS_H
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+typedef struct WalkOptions {
+    int flag_links;
+    int flag_dirs;
+    int flag_files;
+    int threads;
+    int remote_threads;
+    int reader;
+    size_t buffer_size;
+    unsigned int stat_mask;
+    int use_uring;
+    int inode_order;
+    int follow_links;
+    int one_filesystem;
+    int record_stats;
+    int ordered;
+    const struct Predicate *predicate;
+    struct AggregateReport *report;
+    struct WalkStats *stats;
+} WalkOptions;
+
+static inline int classify_entry(mode_t mode) {
+    if (S_ISLNK(mode)) {
+        return 0;
+    } else if (S_ISREG(mode)) {
+        return 1;
+    }
+    return 2;
+}
+
+static inline int should_emit(const WalkOptions *options, int flag) {
+    return (options->flag_links && flag == 0) || (options->flag_dirs && flag == 2) ||
+           (options->flag_files && flag == 1) ||
+           (!options->flag_links && !options->flag_dirs && !options->flag_files);
+}
+
+/* O_DIRECTORY makes fifos and devices fail with ENOTDIR instead of blocking.
+ * Only the start directory may be reached through a symlink. */
+static inline int open_dir_at(int parent_fd, const char *name, int follow) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW);
+    int fd = openat(parent_fd, name, flags);
+    if (fd == -1) {
+        perror("opendir");
+    }
+    return fd;
+}
+
+/* Every level of the walk keeps its directory fd open. */
+static inline void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+#endif
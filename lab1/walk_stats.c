@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "walk_stats.h"
+
+#ifdef DWALK_STATS
+
+static const char *phase_names[PHASE_COUNT] = {
+    "open", "read", "classify", "filter", "close", "emit", "sort", "print"
+};
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void walk_stats_init(WalkStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->start_ticks = stats_ticks();
+    stats->start_ns = now_ns();
+}
+
+static DepthStats *depth_slot(WalkStats *stats, size_t depth) {
+    if (depth >= stats->depth_count) {
+        size_t count = stats->depth_count ? stats->depth_count : 16;
+        while (count <= depth) {
+            count *= 2;
+        }
+        DepthStats *depths = (DepthStats*)realloc(stats->depths, count * sizeof(DepthStats));
+        if (!depths) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(depths + stats->depth_count, 0, (count - stats->depth_count) * sizeof(DepthStats));
+        stats->depths = depths;
+        stats->depth_count = count;
+    }
+    return &stats->depths[depth];
+}
+
+static int size_bucket(uint64_t entries) {
+    int bucket = 0;
+    while (entries > 0 && bucket < STATS_SIZE_BUCKETS - 1) {
+        entries >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* The slowest list is tiny, so a linear scan for its minimum is enough. */
+static void add_sample(WalkStats *stats, const char *path, size_t depth, uint64_t entries, uint64_t ticks) {
+    size_t slot = stats->slowest_count;
+    if (slot == STATS_SLOWEST) {
+        slot = 0;
+        for (size_t i = 1; i < STATS_SLOWEST; i++) {
+            if (stats->slowest[i].ticks < stats->slowest[slot].ticks) {
+                slot = i;
+            }
+        }
+        if (stats->slowest[slot].ticks >= ticks) {
+            return;
+        }
+        free(stats->slowest[slot].path);
+    } else {
+        stats->slowest_count++;
+    }
+    DirSample *sample = &stats->slowest[slot];
+    sample->ticks = ticks;
+    sample->entries = entries;
+    sample->depth = depth;
+    sample->path = strdup(path);
+    if (!sample->path) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void walk_stats_dir(WalkStats *stats, const char *path, size_t depth, uint64_t entries, uint64_t ticks) {
+    DepthStats *slot = depth_slot(stats, depth);
+    slot->dirs++;
+    slot->entries += entries;
+    slot->ticks += ticks;
+    stats->size_histogram[size_bucket(entries)]++;
+    add_sample(stats, path, depth, entries, ticks);
+}
+
+void walk_stats_merge(WalkStats *total, const WalkStats *part) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        total->phase_ticks[i] += part->phase_ticks[i];
+        total->phase_calls[i] += part->phase_calls[i];
+    }
+    for (size_t d = 0; d < part->depth_count; d++) {
+        if (part->depths[d].dirs == 0)
+            continue;
+        DepthStats *slot = depth_slot(total, d);
+        slot->dirs += part->depths[d].dirs;
+        slot->entries += part->depths[d].entries;
+        slot->ticks += part->depths[d].ticks;
+    }
+    for (int b = 0; b < STATS_SIZE_BUCKETS; b++) {
+        total->size_histogram[b] += part->size_histogram[b];
+    }
+    for (size_t i = 0; i < part->slowest_count; i++) {
+        const DirSample *sample = &part->slowest[i];
+        add_sample(total, sample->path, sample->depth, sample->entries, sample->ticks);
+    }
+}
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t ta = ((const DirSample*)a)->ticks, tb = ((const DirSample*)b)->ticks;
+    return (ta < tb) - (ta > tb);
+}
+
+static void json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(file, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        } else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void walk_stats_report(const WalkStats *stats, FILE *file, int json) {
+    long elapsed_ns = now_ns() - stats->start_ns;
+    uint64_t elapsed_ticks = stats_ticks() - stats->start_ticks;
+    double ms_per_tick = (elapsed_ticks > 0) ? (double)elapsed_ns / elapsed_ticks / 1e6 : 0;
+    DirSample slowest[STATS_SLOWEST];
+    memcpy(slowest, stats->slowest, stats->slowest_count * sizeof(DirSample));
+    qsort(slowest, stats->slowest_count, sizeof(DirSample), compare_samples);
+    size_t max_depth = stats->depth_count;
+    while (max_depth > 0 && stats->depths[max_depth - 1].dirs == 0) {
+        max_depth--;
+    }
+    int max_bucket = STATS_SIZE_BUCKETS;
+    while (max_bucket > 0 && stats->size_histogram[max_bucket - 1] == 0) {
+        max_bucket--;
+    }
+
+    if (json) {
+        fprintf(file, "{\"elapsed_ms\":%.3f,\"phases\":{", elapsed_ns / 1e6);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(file, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f}", i ? "," : "", phase_names[i],
+                    (unsigned long long)stats->phase_calls[i], stats->phase_ticks[i] * ms_per_tick);
+        }
+        fprintf(file, "},\"depths\":[");
+        for (size_t d = 0; d < max_depth; d++) {
+            const DepthStats *slot = &stats->depths[d];
+            fprintf(file, "%s{\"depth\":%zu,\"dirs\":%llu,\"entries\":%llu,\"ms\":%.3f}", d ? "," : "", d,
+                    (unsigned long long)slot->dirs, (unsigned long long)slot->entries, slot->ticks * ms_per_tick);
+        }
+        fprintf(file, "],\"dir_sizes\":[");
+        for (int b = 0; b < max_bucket; b++) {
+            fprintf(file, "%s{\"min\":%llu,\"max\":%llu,\"dirs\":%llu}", b ? "," : "",
+                    b ? 1ull << (b - 1) : 0ull, b ? (1ull << b) - 1 : 0ull,
+                    (unsigned long long)stats->size_histogram[b]);
+        }
+        fprintf(file, "],\"slowest\":[");
+        for (size_t i = 0; i < stats->slowest_count; i++) {
+            fprintf(file, "%s{\"ms\":%.3f,\"entries\":%llu,\"depth\":%zu,\"path\":", i ? "," : "",
+                    slowest[i].ticks * ms_per_tick, (unsigned long long)slowest[i].entries, slowest[i].depth);
+            json_string(file, slowest[i].path);
+            fputc('}', file);
+        }
+        fprintf(file, "]}\n");
+        return;
+    }
+
+    fprintf(file, "elapsed %.3f ms\n\n%-10s %12s %12s %7s\n", elapsed_ns / 1e6, "phase", "calls", "ms", "share");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        double ms = stats->phase_ticks[i] * ms_per_tick;
+        fprintf(file, "%-10s %12llu %12.3f %6.1f%%\n", phase_names[i], (unsigned long long)stats->phase_calls[i], ms,
+                elapsed_ns > 0 ? 100.0 * ms * 1e6 / elapsed_ns : 0.0);
+    }
+    fprintf(file, "\n%-10s %12s %12s %12s\n", "depth", "dirs", "entries", "ms");
+    for (size_t d = 0; d < max_depth; d++) {
+        const DepthStats *slot = &stats->depths[d];
+        fprintf(file, "%-10zu %12llu %12llu %12.3f\n", d, (unsigned long long)slot->dirs,
+                (unsigned long long)slot->entries, slot->ticks * ms_per_tick);
+    }
+    fprintf(file, "\n%-21s %12s\n", "entries per dir", "dirs");
+    for (int b = 0; b < max_bucket; b++) {
+        char range[32];
+        if (b <= 1) {
+            snprintf(range, sizeof(range), "%d", b);
+        } else {
+            snprintf(range, sizeof(range), "%llu-%llu", 1ull << (b - 1), (1ull << b) - 1);
+        }
+        fprintf(file, "%-21s %12llu\n", range, (unsigned long long)stats->size_histogram[b]);
+    }
+    fprintf(file, "\nslowest directories\n%12s %12s  %s\n", "ms", "entries", "path");
+    for (size_t i = 0; i < stats->slowest_count; i++) {
+        fprintf(file, "%12.3f %12llu  %s\n", slowest[i].ticks * ms_per_tick,
+                (unsigned long long)slowest[i].entries, slowest[i].path);
+    }
+}
+
+void walk_stats_free(WalkStats *stats) {
+    free(stats->depths);
+    for (size_t i = 0; i < stats->slowest_count; i++) {
+        free(stats->slowest[i].path);
+    }
+    stats->depths = NULL;
+    stats->depth_count = 0;
+    stats->slowest_count = 0;
+}
+
+#endif
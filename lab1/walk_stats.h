@@ -0,0 +1,119 @@
+#ifndef WALK_STATS_H
+#define WALK_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* --stats instrumentation. Only built with -DDWALK_STATS (make STATS=1);
+ * otherwise every STATS_* macro below expands to nothing and the walkers
+ * carry no timers, counters or extra fields. */
+
+enum {
+    PHASE_OPEN,
+    PHASE_READ,
+    PHASE_CLASSIFY,
+    PHASE_FILTER,
+    PHASE_CLOSE,
+    PHASE_EMIT,
+    PHASE_SORT,
+    PHASE_PRINT,
+    PHASE_COUNT
+};
+
+#define STATS_SIZE_BUCKETS 32
+#define STATS_SLOWEST 10
+
+typedef struct DepthStats {
+    uint64_t dirs;
+    uint64_t entries;
+    uint64_t ticks;
+} DepthStats;
+
+typedef struct DirSample {
+    uint64_t ticks;
+    uint64_t entries;
+    size_t depth;
+    char *path;
+} DirSample;
+
+/* One per thread, merged at the end. Ticks are TSC cycles on x86 and
+ * nanoseconds elsewhere; the report converts with a rate measured over the
+ * whole run. size_histogram[b] counts directories with [2^(b-1), 2^b)
+ * entries, bucket 0 the empty ones. */
+typedef struct WalkStats {
+    uint64_t phase_ticks[PHASE_COUNT];
+    uint64_t phase_calls[PHASE_COUNT];
+    DepthStats *depths;
+    size_t depth_count;
+    uint64_t size_histogram[STATS_SIZE_BUCKETS];
+    DirSample slowest[STATS_SLOWEST];
+    size_t slowest_count;
+    uint64_t start_ticks;
+    long start_ns;
+} WalkStats;
+
+#ifdef DWALK_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t stats_ticks(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+static inline uint64_t stats_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+void walk_stats_init(WalkStats *stats);
+/* Records one finished directory: depth, entry count and the ticks spent
+ * opening, reading and classifying it. path is copied only if the
+ * directory makes the slowest list. */
+void walk_stats_dir(WalkStats *stats, const char *path, size_t depth, uint64_t entries, uint64_t ticks);
+void walk_stats_merge(WalkStats *total, const WalkStats *part);
+void walk_stats_report(const WalkStats *stats, FILE *file, int json);
+void walk_stats_free(WalkStats *stats);
+
+/* The timers read the clock only when stats is non-NULL at run time. */
+#define STATS_FIELD(decl) decl;
+#define STATS_START(stats, var) uint64_t var = (stats) ? stats_ticks() : 0
+#define STATS_END(stats, phase, var) \
+    do { \
+        if (stats) { \
+            (stats)->phase_ticks[phase] += stats_ticks() - (var); \
+            (stats)->phase_calls[phase]++; \
+        } \
+    } while (0)
+/* STATS_END that also adds the elapsed ticks to *total. */
+#define STATS_END_ADD(stats, phase, var, total) \
+    do { \
+        if (stats) { \
+            uint64_t stats_elapsed_ = stats_ticks() - (var); \
+            (stats)->phase_ticks[phase] += stats_elapsed_; \
+            (stats)->phase_calls[phase]++; \
+            (total) += stats_elapsed_; \
+        } \
+    } while (0)
+#define STATS_DIR(stats, path, depth, entries, ticks) \
+    do { \
+        if (stats) \
+            walk_stats_dir((stats), (path), (depth), (entries), (ticks)); \
+    } while (0)
+#define STATS_DO(statement) statement
+
+#else
+
+#define STATS_FIELD(decl)
+#define STATS_START(stats, var) ((void)0)
+#define STATS_END(stats, phase, var) ((void)0)
+#define STATS_END_ADD(stats, phase, var, total) ((void)0)
+#define STATS_DIR(stats, path, depth, entries, ticks) ((void)0)
+#define STATS_DO(statement) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,785 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "watch.h"
+#include "classify.h"
+#include "dir_reader.h"
+#include "output.h"
+#include "entry_sort.h"
+#include "path_buffer.h"
+
+#define NO_NODE -1
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define EVENT_BUFFER_SIZE (64 * 1024)
+#define QUERY_BUFFER_SIZE 4096
+
+/* Children of a directory form a doubly linked list in the order they were
+ * found; (parent, name) lookups go through the tree-wide hash. */
+typedef struct WatchNode {
+    char *name;
+    int flag;
+    int parent;
+    int first_child;
+    int last_child;
+    int prev;
+    int next;
+    int wd;
+    int unwatched;
+    unsigned int seen;
+    struct timespec mtime;
+} WatchNode;
+
+/* A subdirectory still to be visited by the frame that found it: loaded
+ * if it is new to the tree, otherwise only checked for a moved mtime. */
+typedef struct SyncItem {
+    int node;
+    int load;
+} SyncItem;
+
+/* A directory on the sync stack. Its items are items[item_base ..] up to
+ * the next frame's base; fd stays open until the last one is opened. */
+typedef struct SyncFrame {
+    int fd;
+    size_t path_len;
+    size_t item_base;
+} SyncFrame;
+
+typedef struct WatchTree {
+    const WalkOptions *options;
+    const char *root;
+    int inotify_fd;
+    WatchNode *nodes;
+    int node_count;
+    int node_capacity;
+    int free_list;
+    int *slots;
+    size_t slot_mask;
+    size_t slot_used;
+    int *wd_nodes;
+    int wd_capacity;
+    int unwatched_count;
+    int limit_reported;
+    unsigned int generation;
+    EntryBatch batch;
+    DirBufferPool buffers;
+    WalkCounters counters;
+    StatRing *ring;
+    PathBuffer path;
+    SyncFrame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    SyncItem *items;
+    size_t item_count;
+    size_t item_capacity;
+} WatchTree;
+
+/* Filters of a single query. */
+typedef struct QueryFilter {
+    WalkOptions options;
+    int sort;
+    unsigned long count;
+    ArrayEntries *array;
+    OutputBuffer *out;
+} QueryFilter;
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static void *grow(void *ptr, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return ptr;
+    }
+    size_t count = *capacity ? *capacity : 64;
+    while (count < needed) {
+        count *= 2;
+    }
+    *capacity = count;
+    return xrealloc(ptr, count * item_size);
+}
+
+static size_t hash_child(int parent, const char *name) {
+    size_t hash = 1469598103934665603ULL ^ (size_t)(unsigned)parent;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int find_child(WatchTree *tree, int parent, const char *name) {
+    if (!tree->slots) {
+        return NO_NODE;
+    }
+    size_t slot = hash_child(parent, name) & tree->slot_mask;
+    while (tree->slots[slot]) {
+        int node = tree->slots[slot] - 1;
+        if (node >= 0 && tree->nodes[node].parent == parent && strcmp(tree->nodes[node].name, name) == 0) {
+            return node;
+        }
+        slot = (slot + 1) & tree->slot_mask;
+    }
+    return NO_NODE;
+}
+
+static void hash_insert(WatchTree *tree, int node);
+
+/* Rebuilds the table without tombstones, growing it if it is half full. */
+static void hash_rebuild(WatchTree *tree) {
+    size_t live = 0;
+    for (int i = 0; i < tree->node_count; i++) {
+        if (tree->nodes[i].flag != -1 && tree->nodes[i].parent != NO_NODE)
+            live++;
+    }
+    size_t size = 1024;
+    while (size < live * 4) {
+        size *= 2;
+    }
+    free(tree->slots);
+    tree->slots = (int*)calloc(size, sizeof(int));
+    if (!tree->slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    tree->slot_mask = size - 1;
+    tree->slot_used = 0;
+    for (int i = 0; i < tree->node_count; i++) {
+        if (tree->nodes[i].flag != -1 && tree->nodes[i].parent != NO_NODE)
+            hash_insert(tree, i);
+    }
+}
+
+static void hash_insert(WatchTree *tree, int node) {
+    if (!tree->slots || (tree->slot_used + 1) * 2 > tree->slot_mask + 1) {
+        hash_rebuild(tree);
+        if (find_child(tree, tree->nodes[node].parent, tree->nodes[node].name) == node)
+            return;
+    }
+    size_t slot = hash_child(tree->nodes[node].parent, tree->nodes[node].name) & tree->slot_mask;
+    while (tree->slots[slot] > 0) {
+        slot = (slot + 1) & tree->slot_mask;
+    }
+    if (tree->slots[slot] == 0) {
+        tree->slot_used++;
+    }
+    tree->slots[slot] = node + 1;
+}
+
+static void hash_remove(WatchTree *tree, int node) {
+    size_t slot = hash_child(tree->nodes[node].parent, tree->nodes[node].name) & tree->slot_mask;
+    while (tree->slots[slot]) {
+        if (tree->slots[slot] == node + 1) {
+            tree->slots[slot] = -1;
+            return;
+        }
+        slot = (slot + 1) & tree->slot_mask;
+    }
+}
+
+static int new_node(WatchTree *tree, int parent, const char *name, int flag) {
+    int node;
+    if (tree->free_list != NO_NODE) {
+        node = tree->free_list;
+        tree->free_list = tree->nodes[node].next;
+    } else {
+        if (tree->node_count == tree->node_capacity) {
+            tree->node_capacity = tree->node_capacity ? tree->node_capacity * 2 : 1024;
+            tree->nodes = (WatchNode*)xrealloc(tree->nodes, tree->node_capacity * sizeof(WatchNode));
+        }
+        node = tree->node_count++;
+    }
+    WatchNode *entry = &tree->nodes[node];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = strdup(name);
+    if (!entry->name) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+    entry->flag = flag;
+    entry->parent = parent;
+    entry->first_child = entry->last_child = NO_NODE;
+    entry->next = NO_NODE;
+    entry->wd = -1;
+    entry->seen = tree->generation;
+    if (parent != NO_NODE) {
+        WatchNode *dir = &tree->nodes[parent];
+        entry->prev = dir->last_child;
+        if (dir->last_child != NO_NODE) {
+            tree->nodes[dir->last_child].next = node;
+        } else {
+            dir->first_child = node;
+        }
+        dir->last_child = node;
+        hash_insert(tree, node);
+    } else {
+        entry->prev = NO_NODE;
+    }
+    return node;
+}
+
+static void free_node(WatchTree *tree, int node) {
+    WatchNode *entry = &tree->nodes[node];
+    if (entry->parent != NO_NODE) {
+        WatchNode *dir = &tree->nodes[entry->parent];
+        if (entry->prev != NO_NODE) {
+            tree->nodes[entry->prev].next = entry->next;
+        } else {
+            dir->first_child = entry->next;
+        }
+        if (entry->next != NO_NODE) {
+            tree->nodes[entry->next].prev = entry->prev;
+        } else {
+            dir->last_child = entry->prev;
+        }
+        hash_remove(tree, node);
+    }
+    if (entry->wd >= 0) {
+        inotify_rm_watch(tree->inotify_fd, entry->wd);
+        tree->wd_nodes[entry->wd] = NO_NODE;
+    }
+    if (entry->unwatched) {
+        tree->unwatched_count--;
+    }
+    free(entry->name);
+    entry->name = NULL;
+    entry->flag = -1;
+    entry->next = tree->free_list;
+    tree->free_list = node;
+}
+
+/* Frees node and everything below it, leaves first, without recursing. */
+static void remove_node(WatchTree *tree, int node) {
+    int current = node;
+    for (;;) {
+        while (tree->nodes[current].first_child != NO_NODE) {
+            current = tree->nodes[current].first_child;
+        }
+        int parent = tree->nodes[current].parent;
+        free_node(tree, current);
+        if (current == node) {
+            return;
+        }
+        current = parent;
+    }
+}
+
+/* Builds node's path into out back to front, so walking up to the root
+ * needs neither recursion nor a PATH_MAX bound. */
+static void node_path(const WatchTree *tree, int node, PathBuffer *out) {
+    size_t len = strlen(tree->root);
+    for (int n = node; tree->nodes[n].parent != NO_NODE; n = tree->nodes[n].parent) {
+        len += strlen(tree->nodes[n].name) + 1;
+    }
+    out->len = 0;
+    path_reserve(out, len);
+    path_truncate(out, len);
+    for (int n = node; tree->nodes[n].parent != NO_NODE; n = tree->nodes[n].parent) {
+        size_t name_len = strlen(tree->nodes[n].name);
+        len -= name_len;
+        memcpy(out->data + len, tree->nodes[n].name, name_len);
+        out->data[--len] = '/';
+    }
+    memcpy(out->data, tree->root, len);
+}
+
+/* Opens node's directory and leaves its path in tree->path. A path too
+ * long for the kernel is opened one component at a time from the root. */
+static int open_node(WatchTree *tree, int node) {
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    node_path(tree, node, &tree->path);
+    if (tree->path.len < PATH_MAX) {
+        return open(tree->path.data, flags);
+    }
+    int fd = open(tree->root, flags);
+    char *name = tree->path.data + strlen(tree->root);
+    while (fd != -1 && *name) {
+        char *end = strchr(++name, '/');
+        if (end) {
+            *end = '\0';
+        }
+        int child = openat(fd, name, flags);
+        int error = errno;
+        close(fd);
+        errno = error;
+        fd = child;
+        if (end) {
+            *end = '/';
+            name = end;
+        } else {
+            name += strlen(name);
+        }
+    }
+    return fd;
+}
+
+/* inotify only takes paths; one too long for the kernel is named through
+ * the directory's fd instead, a link that has to be followed. */
+static void watch_dir(WatchTree *tree, int node, int fd) {
+    WatchNode *entry = &tree->nodes[node];
+    const char *path = tree->path.data;
+    uint32_t mask = WATCH_EVENTS;
+    char fd_path[64];
+    if (tree->path.len >= PATH_MAX) {
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+        path = fd_path;
+        mask &= ~IN_DONT_FOLLOW;
+    }
+    int wd = inotify_add_watch(tree->inotify_fd, path, mask);
+    if (wd == -1) {
+        if (errno != ENOSPC && errno != ENOMEM) {
+            perror("inotify_add_watch");
+        } else if (!tree->limit_reported) {
+            fprintf(stderr, "inotify watch limit reached; unwatched directories are re-read on query\n");
+            tree->limit_reported = 1;
+        }
+        if (!entry->unwatched) {
+            entry->unwatched = 1;
+            tree->unwatched_count++;
+        }
+        return;
+    }
+    if (wd >= tree->wd_capacity) {
+        int capacity = tree->wd_capacity ? tree->wd_capacity : 1024;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        tree->wd_nodes = (int*)xrealloc(tree->wd_nodes, capacity * sizeof(int));
+        for (int i = tree->wd_capacity; i < capacity; i++) {
+            tree->wd_nodes[i] = NO_NODE;
+        }
+        tree->wd_capacity = capacity;
+    }
+    tree->wd_nodes[wd] = node;
+    entry->wd = wd;
+    if (entry->unwatched) {
+        entry->unwatched = 0;
+        tree->unwatched_count--;
+    }
+}
+
+static void push_item(WatchTree *tree, int node, int load) {
+    tree->items = (SyncItem*)grow(tree->items, &tree->item_capacity, tree->item_count + 1, sizeof(SyncItem));
+    tree->items[tree->item_count].node = node;
+    tree->items[tree->item_count].load = load;
+    tree->item_count++;
+}
+
+/* Reads node's directory through a second fd, since fd is still needed to
+ * open the subdirectories, and reconciles its children with what is on
+ * disk. Subdirectories new to the tree become items to load; with all
+ * set the others become items to check. */
+static void read_dir(WatchTree *tree, int node, int fd, const struct stat *st, int all) {
+    tree->nodes[node].mtime = st->st_mtim;
+    const WalkOptions *options = tree->options;
+    char *buffer = (options->reader == READER_GETDENTS) ? dir_buffer_get(&tree->buffers, 0) : NULL;
+    int read_fd = dup(fd);
+    if (read_fd == -1) {
+        perror("dup");
+        return;
+    }
+    DirReader reader;
+    if (dir_reader_open(&reader, read_fd, options->reader, buffer, options->buffer_size) == -1) {
+        return;
+    }
+
+    unsigned int generation = ++tree->generation;
+    EntryBatch *batch = &tree->batch;
+    while (batch_fill(batch, &reader) > 0) {
+        batch_classify(batch, dir_reader_fd(&reader), 0, &tree->ring, &tree->counters);
+        for (size_t i = 0; i < batch->size; i++) {
+            int flag = batch->flags[i];
+            if (flag == -1)
+                continue;
+            const char *name = batch_name(batch, i);
+            int child = find_child(tree, node, name);
+            if (child != NO_NODE && tree->nodes[child].flag == flag) {
+                tree->nodes[child].seen = generation;
+                if (all && flag == 2) {
+                    push_item(tree, child, 0);
+                }
+                continue;
+            }
+            if (child != NO_NODE) {
+                remove_node(tree, child);
+            }
+            child = new_node(tree, node, name, flag);
+            tree->nodes[child].seen = generation;
+            if (flag == 2) {
+                push_item(tree, child, 1);
+            }
+        }
+    }
+    dir_reader_close(&reader);
+
+    int child = tree->nodes[node].first_child;
+    while (child != NO_NODE) {
+        int next = tree->nodes[child].next;
+        if (tree->nodes[child].seen != generation) {
+            remove_node(tree, child);
+        }
+        child = next;
+    }
+}
+
+/* Takes ownership of fd, node's directory; tree->path holds its path. */
+static void push_frame(WatchTree *tree, int node, int fd, int load, int all) {
+    tree->frames = (SyncFrame*)grow(tree->frames, &tree->frame_capacity, tree->frame_count + 1, sizeof(SyncFrame));
+    SyncFrame *frame = &tree->frames[tree->frame_count++];
+    frame->fd = fd;
+    frame->path_len = tree->path.len;
+    frame->item_base = tree->item_count;
+    WatchNode *entry = &tree->nodes[node];
+    if (entry->wd == -1 && (load || entry->unwatched)) {
+        watch_dir(tree, node, fd);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return;
+    }
+    if (load || st.st_mtim.tv_sec != entry->mtime.tv_sec || st.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+        read_dir(tree, node, fd, &st, all);
+    } else if (all) {
+        for (int child = entry->first_child; child != NO_NODE; child = tree->nodes[child].next) {
+            if (tree->nodes[child].flag == 2) {
+                push_item(tree, child, 0);
+            }
+        }
+    }
+}
+
+/* Brings node up to date with the disk on an explicit stack: it is re-read
+ * if load is set or its mtime moved, directories new to the tree are
+ * loaded whole, and with all set every directory below it is checked the
+ * same way. fd is node's directory and tree->path its path. A frame's fd
+ * is closed as soon as its last subdirectory is opened, so a long chain
+ * of single-child directories keeps O(1) fds open. */
+static void sync_dir(WatchTree *tree, int node, int fd, int load, int all) {
+    push_frame(tree, node, fd, load, all);
+    while (tree->frame_count > 0) {
+        SyncFrame *frame = &tree->frames[tree->frame_count - 1];
+        if (tree->item_count == frame->item_base) {
+            if (frame->fd != -1) {
+                close(frame->fd);
+            }
+            tree->frame_count--;
+            continue;
+        }
+        SyncItem item = tree->items[--tree->item_count];
+        const char *name = tree->nodes[item.node].name;
+        path_truncate(&tree->path, frame->path_len);
+        path_push(&tree->path, name);
+        int child_fd = openat(frame->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int error = errno;
+        if (tree->item_count == frame->item_base) {
+            close(frame->fd);
+            frame->fd = -1;
+        }
+        if (child_fd != -1) {
+            push_frame(tree, item.node, child_fd, item.load, all);
+        } else if (!item.load && (error == ENOENT || error == ENOTDIR || error == ELOOP)) {
+            remove_node(tree, item.node);
+        } else {
+            errno = error;
+            perror("opendir");
+        }
+    }
+}
+
+/* Opens node and syncs it; a checked directory that is gone or is no
+ * longer a directory is dropped from the tree. */
+static void sync_node(WatchTree *tree, int node, int load, int all) {
+    int fd = open_node(tree, node);
+    if (fd != -1) {
+        sync_dir(tree, node, fd, load, all);
+    } else if (!load && (errno == ENOENT || errno == ENOTDIR || errno == ELOOP)) {
+        if (tree->nodes[node].parent != NO_NODE) {
+            remove_node(tree, node);
+        }
+    } else {
+        perror("opendir");
+    }
+}
+
+static void refresh_unwatched(WatchTree *tree) {
+    for (int i = 0; i < tree->node_count && tree->unwatched_count > 0; i++) {
+        if (tree->nodes[i].flag != -1 && tree->nodes[i].unwatched) {
+            sync_node(tree, i, 0, 0);
+        }
+    }
+}
+
+static void handle_event(WatchTree *tree, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        sync_node(tree, 0, 0, 1);
+        return;
+    }
+    if (event->wd < 0 || event->wd >= tree->wd_capacity || tree->wd_nodes[event->wd] == NO_NODE) {
+        return;
+    }
+    int node = tree->wd_nodes[event->wd];
+    if (event->mask & IN_IGNORED) {
+        tree->wd_nodes[event->wd] = NO_NODE;
+        tree->nodes[node].wd = -1;
+        return;
+    }
+    if (event->len == 0) {
+        return;
+    }
+    int child = find_child(tree, node, event->name);
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (child != NO_NODE) {
+            remove_node(tree, child);
+        }
+        return;
+    }
+    int dir_fd = open_node(tree, node);
+    if (dir_fd == -1) {
+        return;
+    }
+    struct stat st;
+    if (fstatat(dir_fd, event->name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        close(dir_fd);
+        return;
+    }
+    int flag = classify_entry(st.st_mode);
+    if (child == NO_NODE || tree->nodes[child].flag != flag) {
+        if (child != NO_NODE) {
+            remove_node(tree, child);
+        }
+        child = new_node(tree, node, event->name, flag);
+    }
+    /* A directory already picked up when the parent was loaded keeps its
+     * node and watch and just has its contents reconciled. */
+    if (flag == 2) {
+        path_push(&tree->path, event->name);
+        int fd = openat(dir_fd, event->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            perror("opendir");
+        } else {
+            sync_dir(tree, child, fd, 1, 0);
+        }
+    }
+    close(dir_fd);
+}
+
+static void drain_events(WatchTree *tree) {
+    char buffer[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(tree->inotify_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            if (n == -1 && errno != EAGAIN && errno != EINTR) {
+                perror("read");
+            }
+            return;
+        }
+        for (char *ptr = buffer; ptr < buffer + n;) {
+            const struct inotify_event *event = (const struct inotify_event*)ptr;
+            handle_event(tree, event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/* Visits every node below top depth-first through the child and sibling
+ * links, so no stack is needed; path holds top's path on entry and on
+ * return. */
+static void query_walk(const WatchTree *tree, int top, PathBuffer *path, QueryFilter *filter) {
+    int node = tree->nodes[top].first_child;
+    while (node != NO_NODE) {
+        const WatchNode *entry = &tree->nodes[node];
+        path_push(path, entry->name);
+        if (should_emit(&filter->options, entry->flag)) {
+            filter->count++;
+            if (filter->array) {
+                add_entry(filter->array, path->data, entry->flag);
+            } else if (filter->out) {
+                output_entry(filter->out, entry->flag, path->data);
+            }
+        }
+        if (entry->first_child != NO_NODE) {
+            node = entry->first_child;
+            continue;
+        }
+        path_truncate(path, path->len - strlen(entry->name) - 1);
+        while (node != top && tree->nodes[node].next == NO_NODE) {
+            node = tree->nodes[node].parent;
+            if (node != top) {
+                path_truncate(path, path->len - strlen(tree->nodes[node].name) - 1);
+            }
+        }
+        node = (node == top) ? NO_NODE : tree->nodes[node].next;
+    }
+}
+
+static int resolve_path(const WatchTree *tree, const char *query_path) {
+    size_t root_len = strlen(tree->root);
+    if (strncmp(query_path, tree->root, root_len) == 0 && (query_path[root_len] == '/' || query_path[root_len] == '\0')) {
+        query_path += root_len;
+    }
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s", query_path);
+    int node = 0;
+    char *saveptr = NULL;
+    for (char *part = strtok_r(copy, "/", &saveptr); part; part = strtok_r(NULL, "/", &saveptr)) {
+        if (strcmp(part, ".") == 0)
+            continue;
+        node = find_child((WatchTree*)tree, node, part);
+        if (node == NO_NODE || tree->nodes[node].flag != 2) {
+            return NO_NODE;
+        }
+    }
+    return node;
+}
+
+/* Returns 0 when the query asks to stop. */
+static int run_query(WatchTree *tree, char *line, OutputBuffer *out) {
+    char *saveptr = NULL;
+    char *command = strtok_r(line, " \t", &saveptr);
+    if (!command) {
+        return 1;
+    }
+    if (strcmp(command, "quit") == 0) {
+        return 0;
+    }
+    int list = strcmp(command, "list") == 0;
+    if (!list && strcmp(command, "count") != 0) {
+        fprintf(stderr, "Unknown query: %s (expected list, count or quit)\n", command);
+        return 1;
+    }
+    QueryFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.options = *tree->options;
+    const char *query_path = "";
+    int typed = 0;
+    for (char *arg = strtok_r(NULL, " \t", &saveptr); arg; arg = strtok_r(NULL, " \t", &saveptr)) {
+        if (arg[0] != '-') {
+            query_path = arg;
+            continue;
+        }
+        if (!typed) {
+            filter.options.flag_links = filter.options.flag_dirs = filter.options.flag_files = 0;
+            typed = 1;
+        }
+        for (const char *c = arg + 1; *c; c++) {
+            filter.options.flag_links |= (*c == 'l');
+            filter.options.flag_dirs |= (*c == 'd');
+            filter.options.flag_files |= (*c == 'f');
+            filter.sort |= (*c == 's');
+        }
+    }
+
+    drain_events(tree);
+    refresh_unwatched(tree);
+    int node = resolve_path(tree, query_path);
+    if (node == NO_NODE) {
+        fprintf(stderr, "No such directory in the watched tree: %s\n", query_path);
+        return 1;
+    }
+    node_path(tree, node, &tree->path);
+    ArrayEntries array;
+    memset(&array, 0, sizeof(array));
+    if (list && filter.sort) {
+        filter.array = &array;
+    } else if (list) {
+        filter.out = out;
+    }
+    query_walk(tree, node, &tree->path, &filter);
+    if (list && filter.sort) {
+        sort_entries(&array, tree->options->threads);
+        PathBuffer entry = {NULL, 0, 0};
+        for (size_t i = 0; i < array.size; i++) {
+            output_entry(out, array.entries[i].flag, entry_path(&array, i, &entry));
+        }
+        path_free(&entry);
+        free_entries(&array);
+    } else if (!list) {
+        char text[32];
+        snprintf(text, sizeof(text), "%lu\n", filter.count);
+        output_text(out, text);
+    }
+    output_flush(out);
+    return 1;
+}
+
+int watch_mode(const char *dir_path, const WalkOptions *options) {
+    WatchTree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.options = options;
+    tree.root = dir_path;
+    tree.free_list = NO_NODE;
+    tree.buffers.size = options->buffer_size;
+    tree.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (tree.inotify_fd == -1) {
+        perror("inotify_init1");
+        return EXIT_FAILURE;
+    }
+    int root = new_node(&tree, NO_NODE, dir_path, 2);
+    sync_node(&tree, root, 1, 0);
+
+    OutputBuffer out;
+    output_init(&out, STDOUT_FILENO);
+    char query[QUERY_BUFFER_SIZE];
+    size_t query_len = 0;
+    int running = 1;
+    while (running) {
+        struct pollfd fds[2] = {{tree.inotify_fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            drain_events(&tree);
+        }
+        if (!(fds[1].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+        ssize_t n = read(STDIN_FILENO, query + query_len, sizeof(query) - 1 - query_len);
+        if (n <= 0) {
+            break;
+        }
+        query_len += (size_t)n;
+        char *start = query;
+        char *newline;
+        while (running && (newline = memchr(start, '\n', query + query_len - start))) {
+            *newline = '\0';
+            running = run_query(&tree, start, &out);
+            start = newline + 1;
+        }
+        query_len -= (size_t)(start - query);
+        memmove(query, start, query_len);
+        if (query_len == sizeof(query) - 1) {
+            fprintf(stderr, "Query too long\n");
+            query_len = 0;
+        }
+    }
+
+    output_free(&out);
+    for (int i = 0; i < tree.node_count; i++) {
+        free(tree.nodes[i].name);
+    }
+    free(tree.nodes);
+    free(tree.slots);
+    free(tree.wd_nodes);
+    batch_free(&tree.batch);
+    path_free(&tree.path);
+    free(tree.frames);
+    free(tree.items);
+    dir_buffer_free(&tree.buffers);
+    close(tree.inotify_fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,16 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "walk_options.h"
+
+/* --watch: scans dir_path once, then keeps an in-memory tree current from
+ * inotify events and answers queries read line by line from stdin:
+ *   list [-l] [-d] [-f] [-s] [path]
+ *   count [-l] [-d] [-f] [path]
+ *   quit
+ * Directories that could not get a watch (fs.inotify.max_user_watches) are
+ * re-read before each query if their mtime moved; a queue overflow does
+ * the same mtime check over the whole tree instead of a full rescan. */
+int watch_mode(const char *dir_path, const WalkOptions *options);
+
+#endif